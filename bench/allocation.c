@@ -0,0 +1,52 @@
+#include "framework.h"
+
+// GC_new_object throughput for a few object sizes: objects kept live under one
+// owner, objects dropped as soon as they are made, and objects made a batch at
+// a time through GC_new_objects
+//
+// usage: allocation [objects per run]
+
+#define BATCH 1024
+
+static void RUN ( long count, unsigned long size )
+{
+	static void* batch[BATCH];
+	void* owner;
+	long i;
+	double start;
+	char metric[64];
+	GC_init();
+	owner = GC_new_object(16, GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < count; i++)
+		GC_new_object(size, owner, NULL);
+	sprintf(metric, "live_%lu_rate", size);
+	REPORT("allocation", metric, count / (NOW() - start), "objects/s");
+	GC_terminate(false);
+	GC_init();
+	owner = GC_new_object(16, GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < count; i++)
+		GC_unregister_reference(owner, GC_new_object(size, owner, NULL));
+	sprintf(metric, "transient_%lu_rate", size);
+	REPORT("allocation", metric, count / (NOW() - start), "objects/s");
+	GC_terminate(false);
+	GC_init();
+	owner = GC_new_object(16, GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < count; i += BATCH)
+		GC_new_objects(batch, BATCH, size, owner, NULL);
+	sprintf(metric, "batch_%lu_rate", size);
+	REPORT("allocation", metric, (count + BATCH - 1) / BATCH * BATCH / (NOW() - start), "objects/s");
+	GC_terminate(false);
+}
+
+int main ( int argc, char** argv )
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	REPORT("allocation", "objects", count, "objects");
+	RUN(count, 16);
+	RUN(count, 64);
+	RUN(count, 256);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include "framework.h"
+
+// partial and full collection pauses, and GC_terminate, against heap size and
+// the number of references per object; heaps are random trees with extra
+// references between their objects, settled by a full collection, and each
+// partial collection has a tenth of the heap's worth of new objects to take in
+//
+// usage: collect [largest heap] [most extra references per object]
+
+#define REPEATS 5
+
+static unsigned long long seed;
+
+static unsigned long RANDOM ()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (unsigned long)seed;
+}
+
+static void RUN ( long count, int extra, void** objects )
+{
+	long i, young = count / 10;
+	int j;
+	double start, partial = 0.0, full = 0.0;
+	char metric[64];
+	seed = 88172645463325252ULL;
+	GC_init();
+	for (i = 0; i < count; i++)
+	{
+		objects[i] = GC_new_object(16, i < 64 ? GC_ROOT : objects[RANDOM() % i], NULL);
+		for (j = 0; i >= 64 && j < extra; j++)
+			GC_register_reference(objects[i], objects[RANDOM() % i], NULL);
+	}
+	GC_collect(false);
+	for (i = 0; i < REPEATS; i++)
+	{
+		long k;
+		for (k = 0; k < young; k++)
+			GC_new_object(16, objects[RANDOM() % count], NULL);
+		start = NOW();
+		GC_collect(true);
+		partial += NOW() - start;
+		start = NOW();
+		GC_collect(false);
+		full += NOW() - start;
+	}
+	sprintf(metric, "partial_%ld_objects_%d_extra", count, extra);
+	REPORT("collect", metric, partial / REPEATS * 1000.0, "ms");
+	sprintf(metric, "full_%ld_objects_%d_extra", count, extra);
+	REPORT("collect", metric, full / REPEATS * 1000.0, "ms");
+	start = NOW();
+	GC_terminate(false);
+	sprintf(metric, "terminate_%ld_objects_%d_extra", count, extra);
+	REPORT("collect", metric, (NOW() - start) * 1000.0, "ms");
+}
+
+int main ( int argc, char** argv )
+{
+	long largest = argc > 1 ? atol(argv[1]) : 1000000;
+	int most = argc > 2 ? atoi(argv[2]) : 8;
+	void** objects = (void**)malloc(largest * sizeof(void*));
+	long count = largest;
+	int extra;
+	// up from a hundredth of the largest, in powers of ten
+	while (count >= 100000)
+		count /= 10;
+	for (; count <= largest; count *= 10)
+	{
+		for (extra = 0; extra <= most; extra = extra ? extra * 2 : 1)
+			RUN(count, extra, objects);
+	}
+	free(objects);
+	return 0;
+}
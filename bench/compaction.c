@@ -0,0 +1,93 @@
+#include "framework.h"
+
+// walking a linked list whose nodes were allocated between short-lived objects
+// and linked up in random order, after a partial collection that leaves them
+// where they are against one that copies them out of the youngest generation,
+// which lays them out in list order
+//
+// usage: compaction [nodes] [garbage objects per node]
+
+typedef struct node
+{
+	struct node* next;
+	long value;
+} node;
+
+static unsigned long long seed;
+
+static unsigned long RANDOM ()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (unsigned long)seed;
+}
+
+static void RUN ( const char* mode, long count, int garbage, bool compact )
+{
+	GC_config config;
+	node** nodes = (node**)malloc(count * sizeof(node*));
+	node* head;
+	node* walk;
+	long i, sum = 0;
+	int j, pass;
+	double start;
+	char metric[64];
+	GC_default_config(&config);
+	config.compactNursery = compact;
+	GC_init_with_config(&config);
+	seed = 88172645463325252ULL;
+	head = (node*)GC_new_object(sizeof(node), GC_ROOT, NULL);
+	for (i = 0; i < count; i++)
+	{
+		nodes[i] = (node*)GC_new_object(sizeof(node), head, NULL);
+		nodes[i]->value = i;
+		for (j = 0; j < garbage; j++)
+			GC_unregister_reference(GC_ROOT, GC_new_object(sizeof(node), GC_ROOT, NULL));
+	}
+	for (i = count - 1; i > 0; i--)
+	{
+		long k = RANDOM() % (i + 1);
+		node* swap = nodes[i];
+		nodes[i] = nodes[k];
+		nodes[k] = swap;
+	}
+	// each node ends up held only through the pointer to it
+	head->next = nodes[0];
+	GC_register_reference(head, nodes[0], (void**)&head->next);
+	for (i = 0; i < count; i++)
+	{
+		if (i + 1 < count)
+		{
+			nodes[i]->next = nodes[i + 1];
+			GC_register_reference(nodes[i], nodes[i + 1], (void**)&nodes[i]->next);
+		}
+		GC_unregister_reference(head, nodes[i]);
+	}
+	free(nodes);
+	start = NOW();
+	GC_collect(true);
+	sprintf(metric, "%s_collect", mode);
+	REPORT("compaction", metric, (NOW() - start) * 1000.0, "ms");
+	start = NOW();
+	for (pass = 0; pass < 10; pass++)
+		for (walk = head->next; walk; walk = walk->next)
+			sum += walk->value;
+	sprintf(metric, "%s_walk", mode);
+	REPORT("compaction", metric, (NOW() - start) / (10.0 * count) * 1000000000.0, "ns/node");
+	if (sum != 10 * (count * (count - 1) / 2))
+		printf("list corrupted\n");
+	sprintf(metric, "%s_peak_rss", mode);
+	REPORT("compaction", metric, PEAKRSS() / 1048576.0, "MB");
+	GC_terminate(false);
+}
+
+int main ( int argc, char** argv )
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	int garbage = argc > 2 ? atoi(argv[2]) : 3;
+	REPORT("compaction", "nodes", count, "objects");
+	RUN("in_place", count, garbage, false);
+	RUN("compacted", count, garbage, true);
+	return 0;
+}
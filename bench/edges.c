@@ -0,0 +1,117 @@
+#include "framework.h"
+
+// registers a dense block of strong references and reports their cost, then
+// does the same a row at a time through the batched calls, takes them out one
+// at a time, and registers them through handles. Last, many owners each point
+// one of their own fields at the same target, and then let go of it one by one
+//
+// usage: edges [fanout] [owners sharing a target]
+
+#define OBJECTS 1000
+#define FANOUT 1000
+#define SHARERS 50000
+
+int main ( int argc, char** argv )
+{
+	static void* objects[OBJECTS];
+	static GC_handle handles[OBJECTS];
+	int fanout = argc > 1 ? atoi(argv[1]) : FANOUT;
+	int sharers = argc > 2 ? atoi(argv[2]) : SHARERS;
+	long edges = (long)OBJECTS * fanout;
+	GC_edge* row = (GC_edge*)malloc(fanout * sizeof(GC_edge));
+	void** owners = (void**)malloc(sharers * sizeof(void*));
+	void* target;
+	int i, j;
+	double start, elapsed, rss;
+	GC_init();
+	for (i = 0; i < OBJECTS; i++)
+		objects[i] = GC_new_object(16, GC_ROOT, NULL);
+	rss = PEAKRSS();
+	start = NOW();
+	for (i = 0; i < OBJECTS; i++)
+		for (j = 0; j < fanout; j++)
+			GC_register_reference(objects[i], objects[(i + j) % OBJECTS], NULL);
+	elapsed = NOW() - start;
+	REPORT("edges", "register_rate", edges / elapsed, "edges/s");
+	REPORT("edges", "bytes_per_edge", (PEAKRSS() - rss) / edges, "bytes");
+	start = NOW();
+	GC_collect(false);
+	REPORT("edges", "full_collect", (NOW() - start) * 1000.0, "ms");
+	start = NOW();
+	GC_terminate(false);
+	REPORT("edges", "terminate", (NOW() - start) * 1000.0, "ms");
+	GC_init();
+	GC_new_objects(objects, OBJECTS, 16, GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < OBJECTS; i++)
+	{
+		for (j = 0; j < fanout; j++)
+		{
+			row[j].object = objects[i];
+			row[j].target = objects[(i + j) % OBJECTS];
+			row[j].pointer = NULL;
+		}
+		GC_register_references(row, fanout);
+	}
+	elapsed = NOW() - start;
+	REPORT("edges", "batch_register_rate", edges / elapsed, "edges/s");
+	start = NOW();
+	for (i = 0; i < OBJECTS; i++)
+	{
+		for (j = 0; j < fanout; j++)
+		{
+			row[j].object = objects[i];
+			row[j].target = objects[(i + j) % OBJECTS];
+		}
+		GC_unregister_references(row, fanout);
+	}
+	elapsed = NOW() - start;
+	REPORT("edges", "batch_unregister_rate", edges / elapsed, "edges/s");
+	for (i = 0; i < OBJECTS; i++)
+	{
+		for (j = 0; j < fanout; j++)
+		{
+			row[j].object = objects[i];
+			row[j].target = objects[(i + j) % OBJECTS];
+		}
+		GC_register_references(row, fanout);
+	}
+	// oldest first, from the far end of each owner's list
+	start = NOW();
+	for (i = 0; i < OBJECTS; i++)
+		for (j = 0; j < fanout; j++)
+			GC_unregister_reference(objects[i], objects[(i + j) % OBJECTS]);
+	elapsed = NOW() - start;
+	REPORT("edges", "unregister_rate", edges / elapsed, "edges/s");
+	GC_terminate(false);
+	GC_init();
+	for (i = 0; i < OBJECTS; i++)
+		handles[i] = GC_new_object_h(16, GC_ROOT_HANDLE, NULL);
+	start = NOW();
+	for (i = 0; i < OBJECTS; i++)
+		for (j = 0; j < fanout; j++)
+			GC_register_reference_h(handles[i], handles[(i + j) % OBJECTS], NULL);
+	elapsed = NOW() - start;
+	REPORT("edges", "handle_register_rate", edges / elapsed, "edges/s");
+	GC_terminate(false);
+	GC_init();
+	target = GC_new_object(16, GC_ROOT, NULL);
+	GC_new_objects(owners, sharers, sizeof(void*), GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < sharers; i++)
+	{
+		*(void**)owners[i] = target;
+		GC_register_reference(owners[i], target, (void**)owners[i]);
+	}
+	elapsed = NOW() - start;
+	REPORT("edges", "shared_register_rate", sharers / elapsed, "edges/s");
+	start = NOW();
+	for (i = 0; i < sharers; i++)
+		GC_unregister_reference(owners[i], target);
+	elapsed = NOW() - start;
+	REPORT("edges", "shared_unregister_rate", sharers / elapsed, "edges/s");
+	GC_terminate(false);
+	free(owners);
+	free(row);
+	return 0;
+}
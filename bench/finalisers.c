@@ -0,0 +1,53 @@
+#include "framework.h"
+
+// the pause of a full collection that frees objects with slow finalisers, with
+// the finalisers run as the objects die against queued and run afterwards
+//
+// usage: finalisers [objects] [microseconds per finaliser]
+
+static double cost;
+
+static void SLOW ( void* object )
+{
+	double end = NOW() + cost;
+	while (NOW() < end)
+		;
+}
+
+static void RUN ( const char* mode, long count, bool deferred )
+{
+	GC_config config;
+	void* owner;
+	long i;
+	double start;
+	char metric[64];
+	GC_default_config(&config);
+	config.deferFinalisers = deferred;
+	GC_init_with_config(&config);
+	owner = GC_new_object(16, GC_ROOT, NULL);
+	for (i = 0; i < count; i++)
+		GC_new_object(16, owner, SLOW);
+	// a cycle keeps the owner from being freed on the spot
+	GC_register_reference(owner, owner, NULL);
+	GC_unregister_reference(GC_ROOT, owner);
+	start = NOW();
+	GC_collect(false);
+	sprintf(metric, "%s_collect", mode);
+	REPORT("finalisers", metric, (NOW() - start) * 1000.0, "ms");
+	start = NOW();
+	GC_run_finalisers(0);
+	sprintf(metric, "%s_run", mode);
+	REPORT("finalisers", metric, (NOW() - start) * 1000.0, "ms");
+	GC_terminate(false);
+}
+
+int main ( int argc, char** argv )
+{
+	long count = argc > 1 ? atol(argv[1]) : 10000;
+	cost = (argc > 2 ? atof(argv[2]) : 10.0) / 1000000.0;
+	REPORT("finalisers", "objects", count, "objects");
+	REPORT("finalisers", "cost", cost * 1000000.0, "us");
+	RUN("inline", count, false);
+	RUN("deferred", count, true);
+	return 0;
+}
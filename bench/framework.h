@@ -0,0 +1,31 @@
+#include "gc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// benchmarking framework
+//
+// results are printed one per line as: benchmark <tab> metric <tab> value <tab> unit
+
+static double NOW ()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// peak resident set size in bytes
+static double PEAKRSS ()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (double)usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024.0;
+#endif
+}
+
+#define REPORT(bench, metric, value, unit) printf("%s\t%s\t%.3f\t%s\n", bench, metric, (double)(value), unit)
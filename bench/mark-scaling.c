@@ -0,0 +1,62 @@
+#include "framework.h"
+#include <unistd.h>
+
+// full collection pause against marking thread count on a synthetic heap
+//
+// usage: mark-scaling [objects] [max threads]
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned long RANDOM ()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (unsigned long)seed;
+}
+
+static double PAUSE ( long count, unsigned threads, void** objects )
+{
+	GC_config config;
+	long i;
+	double start, elapsed;
+	GC_default_config(&config);
+	config.markThreads = threads;
+	GC_init_with_config(&config);
+	seed = 88172645463325252ULL;
+	// a random recursive tree is shallow and bushy; one extra edge each makes it a graph
+	for (i = 0; i < count; i++)
+		objects[i] = GC_new_object(16, i < 64 ? GC_ROOT : objects[RANDOM() % i], NULL);
+	for (i = 0; i < count; i++)
+		GC_register_reference(objects[i], objects[RANDOM() % count], NULL);
+	// promote everything so the timed collection is one pass per generation over a settled heap
+	GC_collect(false);
+	start = NOW();
+	GC_collect(false);
+	elapsed = NOW() - start;
+	GC_terminate(false);
+	return elapsed;
+}
+
+int main ( int argc, char** argv )
+{
+	long count = argc > 1 ? atol(argv[1]) : 10000000;
+	long maxThreads = argc > 2 ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	void** objects = (void**)malloc(count * sizeof(void*));
+	double serial = 0.0;
+	unsigned threads;
+	char metric[64];
+	REPORT("mark-scaling", "objects", count, "objects");
+	for (threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		double pause = PAUSE(count, threads, objects);
+		if (threads == 1)
+			serial = pause;
+		sprintf(metric, "pause_threads_%u", threads);
+		REPORT("mark-scaling", metric, pause * 1000.0, "ms");
+		sprintf(metric, "speedup_threads_%u", threads);
+		REPORT("mark-scaling", metric, serial / pause, "x");
+	}
+	free(objects);
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include "framework.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+// how long a mutator gets held up, with full collections run stop-the-world by
+// another thread against the same collections run by the background collector;
+// needs the thread-safe build (run-bench pauses.c gc-mt.o)
+//
+// a settled heap of random trees stays live while the mutator allocates,
+// links and drops objects; every iteration is timed and the times go into a
+// histogram of power-of-two microsecond buckets
+//
+// usage: pauses [live objects] [seconds per mode] [milliseconds between collections]
+
+#define RING 64
+#define BUCKETS 32
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned long RANDOM ()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (unsigned long)seed;
+}
+
+static volatile int stopping;
+static unsigned interval;
+static unsigned long histogram[BUCKETS];
+
+static void* COLLECT ( void* context )
+{
+	while (!stopping)
+	{
+		usleep(interval * 1000);
+		GC_collect(false);
+	}
+	return NULL;
+}
+
+static unsigned long MUTATE ( double seconds )
+{
+	void* ring[RING] = { NULL };
+	void* owner = GC_new_object(16, GC_ROOT, NULL);
+	double end = NOW() + seconds;
+	unsigned long i;
+	int slot;
+	for (i = 0; NOW() < end; i++)
+	{
+		double start = NOW();
+		unsigned long elapsed;
+		int bucket = 0;
+		void* object = GC_new_object(32, owner, NULL);
+		slot = i % RING;
+		if (ring[(slot + 1) % RING])
+		{
+			GC_register_reference(object, ring[(slot + 1) % RING], NULL);
+			GC_unregister_reference(object, ring[(slot + 1) % RING]);
+		}
+		if (ring[slot])
+			GC_unregister_reference(owner, ring[slot]);
+		ring[slot] = object;
+		elapsed = (unsigned long)((NOW() - start) * 1000000.0);
+		while (bucket < BUCKETS - 1 && elapsed >= (1UL << bucket))
+			bucket++;
+		histogram[bucket]++;
+	}
+	GC_unregister_reference(GC_ROOT, owner);
+	return i;
+}
+
+// the smallest bucket bound below which the given fraction of iterations finished
+static unsigned long PERCENTILE ( unsigned long total, double fraction )
+{
+	unsigned long seen = 0;
+	int bucket;
+	for (bucket = 0; bucket < BUCKETS; bucket++)
+	{
+		seen += histogram[bucket];
+		if (seen >= total * fraction)
+			break;
+	}
+	return 1UL << bucket;
+}
+
+static void RUN ( const char* mode, long live, double seconds, bool background )
+{
+	GC_config config;
+	pthread_t collecting;
+	unsigned long total;
+	long i;
+	int bucket;
+	char metric[64];
+	void** objects = (void**)malloc(live * sizeof(void*));
+	GC_default_config(&config);
+	if (background)
+		config.backgroundInterval = interval;
+	GC_init_with_config(&config);
+	seed = 88172645463325252ULL;
+	for (i = 0; i < live; i++)
+		objects[i] = GC_new_object(16, i < 64 ? GC_ROOT : objects[RANDOM() % i], NULL);
+	GC_collect(false);
+	memset(histogram, 0, sizeof(histogram));
+	stopping = 0;
+	if (!background)
+		pthread_create(&collecting, NULL, COLLECT, NULL);
+	total = MUTATE(seconds);
+	stopping = 1;
+	if (!background)
+		pthread_join(collecting, NULL);
+	GC_terminate(false);
+	free(objects);
+	sprintf(metric, "%s_rate", mode);
+	REPORT("pauses", metric, total / seconds / 1000000.0, "Miterations/s");
+	sprintf(metric, "%s_p50", mode);
+	REPORT("pauses", metric, PERCENTILE(total, 0.5), "us");
+	sprintf(metric, "%s_p99", mode);
+	REPORT("pauses", metric, PERCENTILE(total, 0.99), "us");
+	sprintf(metric, "%s_p999", mode);
+	REPORT("pauses", metric, PERCENTILE(total, 0.999), "us");
+	sprintf(metric, "%s_max", mode);
+	REPORT("pauses", metric, PERCENTILE(total, 1.0), "us");
+	for (bucket = 0; bucket < BUCKETS; bucket++)
+	{
+		if (!histogram[bucket])
+			continue;
+		sprintf(metric, "%s_under_%lu_us", mode, 1UL << bucket);
+		REPORT("pauses", metric, histogram[bucket], "iterations");
+	}
+}
+
+int main ( int argc, char** argv )
+{
+	long live = argc > 1 ? atol(argv[1]) : 1000000;
+	double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+	interval = argc > 3 ? atoi(argv[3]) : 100;
+	REPORT("pauses", "live", live, "objects");
+	REPORT("pauses", "interval", interval, "ms");
+	RUN("stop_the_world", live, seconds, false);
+	RUN("background", live, seconds, true);
+	return 0;
+}
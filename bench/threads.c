@@ -0,0 +1,131 @@
+#include "framework.h"
+#include <pthread.h>
+#include <unistd.h>
+
+// mutator throughput against thread count; needs the thread-safe build (run-bench threads.c gc-mt.o)
+//
+// the mixed workload allocates an object per iteration, links and unlinks an
+// edge from it, and drops the oldest object in a per-thread ring, so the heap
+// stays small and objects die steadily; the allocation workload only allocates
+//
+// each runs with every thread's objects held by an owner of its own, by one
+// owner all the threads share, and by the root object directly, the last two
+// putting every thread's new references on the same owner
+//
+// usage: threads [iterations per thread] [max threads]
+
+#define RING 64
+
+typedef enum owners
+{
+	PRIVATE,
+	SHARED,
+	ROOT
+} owners;
+
+static const char* ownerNames[] = { "", "shared_", "root_" };
+
+static long iterations;
+
+// the owner a thread's objects go under, given the shared one or NULL
+static void* OWNER ( void* shared )
+{
+	return shared ? shared : GC_new_object(16, GC_ROOT, NULL);
+}
+
+static void DROPOWNER ( void* owner, void* shared )
+{
+	if (!shared)
+		GC_unregister_reference(GC_ROOT, owner);
+}
+
+static void* MUTATE ( void* context )
+{
+	void* ring[RING] = { NULL };
+	void* owner = OWNER(context);
+	long i;
+	int slot;
+	for (i = 0; i < iterations; i++)
+	{
+		void* object = GC_new_object(32, owner, NULL);
+		slot = i % RING;
+		if (ring[(slot + 1) % RING])
+		{
+			GC_register_reference(object, ring[(slot + 1) % RING], NULL);
+			GC_unregister_reference(object, ring[(slot + 1) % RING]);
+		}
+		if (ring[slot])
+			GC_unregister_reference(owner, ring[slot]);
+		ring[slot] = object;
+	}
+	DROPOWNER(owner, context);
+	return NULL;
+}
+
+static void* ALLOCATE ( void* context )
+{
+	void* owner = OWNER(context);
+	long i;
+	for (i = 0; i < iterations; i++)
+		GC_new_object(32, owner, NULL);
+	DROPOWNER(owner, context);
+	return NULL;
+}
+
+static double RUN ( unsigned threads, void* (*workload)(void*), owners kind )
+{
+	pthread_t workers[64];
+	unsigned i;
+	double start, elapsed;
+	void* shared = NULL;
+	GC_init();
+	if (kind == SHARED)
+		shared = GC_new_object(16, GC_ROOT, NULL);
+	else if (kind == ROOT)
+		shared = GC_ROOT;
+	start = NOW();
+	for (i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, workload, shared);
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+	elapsed = NOW() - start;
+	GC_terminate(false);
+	return elapsed;
+}
+
+int main ( int argc, char** argv )
+{
+	long maxThreads = argc > 2 ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	double serial[3], serialAllocation[3];
+	unsigned threads;
+	int kind;
+	char metric[64];
+	iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	if (maxThreads > 64)
+		maxThreads = 64;
+	REPORT("threads", "iterations", iterations, "per thread");
+	for (threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		for (kind = PRIVATE; kind <= ROOT; kind++)
+		{
+			const char* name = ownerNames[kind];
+			// four API calls per iteration: allocate, register, unregister, release
+			double rate = threads * iterations * 4 / RUN(threads, MUTATE, kind);
+			double allocationRate = threads * iterations / RUN(threads, ALLOCATE, kind);
+			if (threads == 1)
+			{
+				serial[kind] = rate;
+				serialAllocation[kind] = allocationRate;
+			}
+			sprintf(metric, "%srate_threads_%u", name, threads);
+			REPORT("threads", metric, rate / 1000000.0, "Mops/s");
+			sprintf(metric, "%sscaling_threads_%u", name, threads);
+			REPORT("threads", metric, rate / serial[kind], "x");
+			sprintf(metric, "alloc_%srate_threads_%u", name, threads);
+			REPORT("threads", metric, allocationRate / 1000000.0, "Mallocs/s");
+			sprintf(metric, "alloc_%sscaling_threads_%u", name, threads);
+			REPORT("threads", metric, allocationRate / serialAllocation[kind], "x");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include "framework.h"
+
+// the cost of clearing weak references when their targets die: a full
+// collection frees the same objects with and without weak references onto
+// them, and the difference is put down to the weak references
+//
+// usage: weak [objects] [weak references per object]
+
+#define HOLDERS 64
+
+static double COLLECT ( long count, int weak, void** pointers )
+{
+	static void* holders[HOLDERS];
+	void* owner;
+	long i;
+	int j;
+	double start, elapsed;
+	GC_init();
+	for (i = 0; i < HOLDERS; i++)
+		holders[i] = GC_new_object(16, GC_ROOT, NULL);
+	owner = GC_new_object(16, GC_ROOT, NULL);
+	start = NOW();
+	for (i = 0; i < count; i++)
+	{
+		void* object = GC_new_object(16, owner, NULL);
+		for (j = 0; j < weak; j++)
+		{
+			void** pointer = &pointers[i * weak + j];
+			*pointer = object;
+			GC_register_weak_reference(holders[(i + j) % HOLDERS], object, pointer);
+		}
+	}
+	elapsed = NOW() - start;
+	if (weak)
+		REPORT("weak", "register_rate", count * weak / elapsed, "references/s");
+	// a cycle keeps the owner from being freed on the spot
+	GC_register_reference(owner, owner, NULL);
+	GC_unregister_reference(GC_ROOT, owner);
+	start = NOW();
+	GC_collect(false);
+	elapsed = NOW() - start;
+	for (i = 0; i < count * weak; i++)
+	{
+		if (pointers[i])
+		{
+			printf("weak reference not cleared\n");
+			exit(1);
+		}
+	}
+	GC_terminate(false);
+	return elapsed;
+}
+
+int main ( int argc, char** argv )
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	int weak = argc > 2 ? atoi(argv[2]) : 4;
+	void** pointers = (void**)malloc(count * weak * sizeof(void*));
+	double plain, cleared;
+	REPORT("weak", "objects", count, "objects");
+	REPORT("weak", "references", weak, "per object");
+	plain = COLLECT(count, 0, pointers);
+	cleared = COLLECT(count, weak, pointers);
+	REPORT("weak", "plain_collect", plain * 1000.0, "ms");
+	REPORT("weak", "weak_collect", cleared * 1000.0, "ms");
+	REPORT("weak", "invalidate_cost", (cleared - plain) / (count * weak) * 1000000000.0, "ns/reference");
+	free(pointers);
+	return 0;
+}
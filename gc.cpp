@@ -1,15 +1,18 @@
 #include "gc.h"
-#include <set>
-#include <map>
+#include <algorithm>
+#include <functional>
 #include <vector>
-#include <queue>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef WIN32
 #include <windows.h>
 #else
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
 #endif
 
 //#define GC_DEBUG
@@ -22,7 +25,10 @@
 #define ASSERT(x, msg)
 #endif
 
+// build with -DGC_THREAD_SAFE to let several mutator threads share the heap
+#if !defined(GC_THREAD_SAFE) || defined(WIN32)
 #define SINGLE_THREADED
+#endif
 
 namespace
 {
@@ -40,8 +46,7 @@ void (*weakInvalidator)(void*, void**) = DefaultWeakInvalidator;
 
 class GCObject;
 
-class GCWeakReference;
-class GCStrongReference;
+class GCReference;
 
 inline void Yield ()
 {
@@ -68,663 +73,4103 @@ inline void Yield ()
 	}\
 }
 
-#ifdef SINGLE_THREADED
-class GCLock
-{
-public:
-	GCLock () {}
-	~GCLock () {}
-	void ReadLock () {}
-	void ReadUnlock () {}
-	void WriteLock () {}
-	void WriteUnlock () {}
-};
-#else
-static bool AtomicCAS ( volatile uint32_t* ptr, uint32_t oldVal, uint32_t newVal )
+inline bool AtomicCAS ( volatile uint32_t* ptr, uint32_t oldVal, uint32_t newVal )
 {
 	return __sync_bool_compare_and_swap(ptr, oldVal, newVal);
 }
 
-static void AtomicFence ()
+inline void AtomicFence ()
 {
 	__sync_synchronize();
 }
 
-static bool AtomicBitwise ( volatile uint32_t* ptr, uint32_t set, uint32_t clear, bool tryOnly = false )
+inline uint32_t AtomicAdd ( volatile uint32_t* ptr, int32_t delta )
 {
-	uint32_t oldVal, newVal;
-	do
-	{
-		oldVal = *ptr;
-		newVal = oldVal | set;
-		newVal = newVal & ~clear;
-		if (tryOnly)
-		{
-			return AtomicCAS(ptr, oldVal, newVal);
-		}
-	} while (!AtomicCAS(ptr, oldVal, newVal));
-	return true;
+	return __sync_add_and_fetch(ptr, delta);
 }
 
-static bool AtomicSetBits ( volatile uint32_t* ptr, uint32_t bits, bool tryOnly = false )
+inline int64_t AtomicAdd64 ( volatile int64_t* ptr, int64_t delta )
 {
-	return AtomicBitwise(ptr, bits, 0, tryOnly);
+	return __sync_add_and_fetch(ptr, delta);
 }
 
-static bool AtomicClearBits ( volatile uint32_t* ptr, uint32_t bits, bool tryOnly = false )
+inline uint32_t AtomicLoad ( volatile uint32_t* ptr )
 {
-	return AtomicBitwise(ptr, 0, bits, tryOnly);
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
 }
 
-class GCLock
+inline void AtomicStore ( volatile uint32_t* ptr, uint32_t value )
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+template <typename T>
+inline T* AtomicLoadPointer ( T* volatile* ptr )
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void AtomicStorePointer ( T* volatile* ptr, T* value )
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+// for short critical sections between collector threads
+class GCSpinLock
 {
 private:
-	volatile uint32_t status;
+	volatile uint32_t word;
 public:
-	GCLock () : status(0) {}
-	~GCLock () {}
+	GCSpinLock () : word(0) {}
+	void Lock ()
+	{
+		while (__sync_lock_test_and_set(&word, 1))
+			WAITCONDITION(AtomicLoad(&word) == 0);
+	}
+	void Unlock ()
+	{
+		__sync_lock_release(&word);
+	}
+};
+
+#ifdef SINGLE_THREADED
+// nothing runs alongside the mutator, so the structures it touches need no locking
+class GCMutatorLock
+{
+public:
+	void Lock () {}
+	void Unlock () {}
+};
+#else
+typedef GCSpinLock GCMutatorLock;
+#endif
+
+// open-addressed map from addresses to T*
+template <typename T>
+class GCAddressMap
+{
+private:
+	struct Slot
+	{
+		void* address;
+		T* object;
+	};
+	Slot* slots;
+	size_t mask;
+	size_t count;
 	
-	void ReadLock ()
+	size_t Hash ( void* address ) const
+	{
+		uint64_t key = (uint64_t)(uintptr_t)address;
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return (size_t)key & mask;
+	}
+	
+	void Grow ()
 	{
-		bool haveLock = false;
-		while (!haveLock)
+		Slot* oldSlots = slots;
+		size_t oldCapacity = mask + 1;
+		mask = (oldCapacity << 1) - 1;
+		slots = (Slot*)calloc(mask + 1, sizeof(Slot));
+		ASSERT(slots, "could not grow address map");
+		for (size_t i = 0; i < oldCapacity; i++)
 		{
-			// waiting on a write
-			WAITCONDITION((status & 3) == 0);
-			uint32_t oldReadCount = status;
-			uint32_t newReadCount = status >> 2;
-			newReadCount += 1;
-			newReadCount <<= 2;
-			haveLock = AtomicCAS(&status, oldReadCount, newReadCount);
-			AtomicFence();
+			if (oldSlots[i].address)
+			{
+				size_t j = Hash(oldSlots[i].address);
+				while (slots[j].address)
+					j = (j + 1) & mask;
+				slots[j] = oldSlots[i];
+			}
 		}
-		DEBUG(printf("[GC] +LK RD\n"));
+		free(oldSlots);
 	}
+public:
+	bool Empty () const { return count == 0; }
 	
-	void ReadUnlock ()
+	GCAddressMap () : slots(NULL), mask(0), count(0) { Clear(); }
+	~GCAddressMap () { free(slots); }
+	
+	void Clear ()
+	{
+		free(slots);
+		mask = 1023;
+		count = 0;
+		slots = (Slot*)calloc(mask + 1, sizeof(Slot));
+	}
+	
+	T* Find ( void* address ) const
 	{
-		bool haveUnlock = false;
-		while (!haveUnlock)
+		for (size_t i = Hash(address); slots[i].address; i = (i + 1) & mask)
 		{
-			uint32_t oldReadCount = status;
-			uint32_t newReadCount = status >> 2;
-			ASSERT(newReadCount > 0, "unlocking already unlocked read lock");
-			newReadCount -= 1;
-			newReadCount <<= 2;
-			haveUnlock = AtomicCAS(&status, oldReadCount, newReadCount);
-			AtomicFence();
+			if (slots[i].address == address)
+				return slots[i].object;
 		}
-		DEBUG(printf("[GC] -LK RD\n"));
+		return NULL;
 	}
 	
-	void WriteLock ()
+	void Insert ( void* address, T* object )
 	{
-		bool haveLock = false;
-		const uint32_t MASK = ~3;
-		while (!haveLock)
+		ASSERT(address, "inserted null address into address map");
+		if ((count + 1) * 4 > (mask + 1) * 3)
+			Grow();
+		size_t i = Hash(address);
+		while (slots[i].address)
 		{
-			AtomicSetBits(&status, 2);
-			WAITCONDITION((status & MASK) == 0);
-			haveLock = AtomicBitwise(&status, 1, 2, true);
-			AtomicFence();
+			if (slots[i].address == address)
+			{
+				slots[i].object = object;
+				return;
+			}
+			i = (i + 1) & mask;
 		}
-		DEBUG(printf("[GC] +LK WR\n"));
+		slots[i].address = address;
+		slots[i].object = object;
+		count++;
 	}
 	
-	void WriteUnlock ()
+	void Remove ( void* address )
 	{
-		ASSERT(status & 1, "unlocked already unlocked write lock");
-		AtomicClearBits(&status, 1);
-		AtomicFence();
-		DEBUG(printf("[GC] -LK WR\n"));
+		size_t i = Hash(address);
+		while (slots[i].address != address)
+		{
+			if (!slots[i].address)
+				return;
+			i = (i + 1) & mask;
+		}
+		// backward-shift deletion keeps probe chains intact without tombstones
+		size_t j = i;
+		for (;;)
+		{
+			slots[i].address = NULL;
+			slots[i].object = NULL;
+			size_t k;
+			do
+			{
+				j = (j + 1) & mask;
+				if (!slots[j].address)
+				{
+					count--;
+					return;
+				}
+				k = Hash(slots[j].address);
+			} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+			slots[i] = slots[j];
+			i = j;
+		}
 	}
 };
-#endif
 
-class GCReference
+#define GC_CHUNK_SHIFT 18
+#define GC_CHUNK_SIZE ((size_t)1 << GC_CHUNK_SHIFT)
+#define GC_GRANULE 16
+#define GC_LARGE_OBJECT 32768
+#define GC_POOL_BLOCK 65536
+
+// fixed-size cells carved out of large blocks, recycled through a free list
+class GCPool
 {
-protected:
-	GCObject* owner;
-	GCObject* target;
-	void** pointerLocation;
+private:
+	struct Cell
+	{
+		Cell* next;
+	};
+	size_t cellSize;
+	Cell* freeList;
+	char* block;
+	size_t blockUsed;
+	std::vector<char*> blocks;
 public:
-	GCReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation )
-	: owner(anOwner),
-	  target(aTarget),
-	  pointerLocation(aPointerLocation)
+	GCPool ( size_t aCellSize )
+	: cellSize((aCellSize + sizeof(void*) - 1) & ~(sizeof(void*) - 1)),
+	  freeList(NULL),
+	  block(NULL),
+	  blockUsed(GC_POOL_BLOCK)
 	{
-		ASSERT(anOwner, "reference constructed with null owner");
-		ASSERT(aTarget, "reference constructed with null target");
 	}
 	
-	virtual ~GCReference ()
+	~GCPool () { ReleaseAll(); }
+	
+	void* Allocate ()
 	{
+		if (freeList)
+		{
+			Cell* cell = freeList;
+			freeList = cell->next;
+			return cell;
+		}
+		if (blockUsed + cellSize > GC_POOL_BLOCK)
+		{
+			block = (char*)malloc(GC_POOL_BLOCK);
+			ASSERT(block, "could not allocate pool block");
+			blocks.push_back(block);
+			blockUsed = 0;
+		}
+		void* cell = block + blockUsed;
+		blockUsed += cellSize;
+		return cell;
 	}
 	
-	void** PointerLocation () const { return pointerLocation; }
-	GCObject* Owner () const { return owner; }
-	GCObject* Target () const { return target; }
-	
-	virtual void OwnerDied () = 0;	
-	virtual void OwnerDisowned () = 0;
-	virtual void TargetDied () = 0;
-	virtual bool IsWeak () const = 0;
-	
-	GCWeakReference* WeakReference ();
-	GCStrongReference* StrongReference ();
-};
-
-class GCWeakReference : public GCReference
-{
-public:
-	GCWeakReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation );
-	virtual ~GCWeakReference ();
-	
-	virtual void OwnerDied ();	
-	virtual void OwnerDisowned ();
-	virtual void TargetDied ();
-	
-	virtual bool IsWeak () const { return true; }
-};
-
-class GCStrongReference : public GCReference
-{
-public:
-	GCStrongReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation );
-	virtual ~GCStrongReference ();
-	
-	virtual void OwnerDied ();	
-	virtual void OwnerDisowned ();
-	virtual void TargetDied ();
+	void Free ( void* ptr )
+	{
+		Cell* cell = (Cell*)ptr;
+		cell->next = freeList;
+		freeList = cell;
+	}
 	
-	virtual bool IsWeak () const { return false; }
+	void ReleaseAll ()
+	{
+		for (std::vector<char*>::iterator iter = blocks.begin(); iter != blocks.end(); ++iter)
+			free(*iter);
+		blocks.clear();
+		freeList = NULL;
+		block = NULL;
+		blockUsed = GC_POOL_BLOCK;
+	}
 };
 
-GCWeakReference* GCReference::WeakReference ()
+static void* AllocateAligned ( size_t len )
 {
-	if (IsWeak())
-		return static_cast<GCWeakReference*>(this);
-	else
+#ifdef WIN32
+	return _aligned_malloc(len, GC_CHUNK_SIZE);
+#else
+	void* ptr;
+	if (posix_memalign(&ptr, GC_CHUNK_SIZE, len))
 		return NULL;
+	return ptr;
+#endif
 }
 
-GCStrongReference* GCReference::StrongReference ()
+static void FreeAligned ( void* ptr )
 {
-	if (!IsWeak())
-		return static_cast<GCStrongReference*>(this);
-	else
-		return NULL;
+#ifdef WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
 }
 
-GCObject* rootObject;
+// a chunk-aligned run of equally sized slots; the headers of the objects
+// living in those slots are found through a side table at the chunk's start
+struct GCChunk
+{
+	GCChunk* prev;
+	GCChunk* next;
+	int sizeClass; // -1 for a dedicated large-object chunk
+	size_t slotSize;
+	size_t slotCount;
+	size_t liveCount;
+	size_t bumpIndex; // slots from here on have never been handed out
+	void* freeSlots;
+	bool owned; // some thread's allocation buffer is carving it up
+	char* firstSlot;
+	GCObject** headers;
+	
+	size_t SlotIndex ( void* ptr ) const
+	{
+		return (size_t)((char*)ptr - firstSlot) / slotSize;
+	}
+	
+	GCObject* ObjectAt ( void* ptr ) const
+	{
+		if ((char*)ptr < firstSlot)
+			return NULL;
+		size_t offset = (size_t)((char*)ptr - firstSlot);
+		if (offset % slotSize)
+			return NULL;
+		size_t index = offset / slotSize;
+		if (index >= slotCount)
+			return NULL;
+		return headers[index];
+	}
+	
+	void SetObject ( void* ptr, GCObject* object )
+	{
+		headers[SlotIndex(ptr)] = object;
+	}
+};
 
-class GCObject
+// chunks by base address, as a three-level radix table over the address bits
+// above the chunk size; lookups never lock, and a new chunk is published with
+// release stores, so threads allocating elsewhere can still find objects
+class GCChunkMap
 {
 private:
-	void* address;
-	void (*finaliser)(void*);
-	bool condemned;
-	size_t selfAssignedLength;
-public:
-	std::set<GCReference*> pointingReferences;
-	std::set<GCReference*> ownedReferences;
+	enum { LEVELBITS = 15, LEVELSIZE = 1 << LEVELBITS };
+	typedef GCChunk* volatile Leaf[LEVELSIZE];
+	typedef Leaf* volatile Middle[LEVELSIZE];
+	enum { ROOTBITS = sizeof(uintptr_t) * 8 - GC_CHUNK_SHIFT - 2 * LEVELBITS };
+	enum { ROOTSIZE = ROOTBITS > 0 ? 1 << ROOTBITS : 1 };
+	Middle* volatile* root;
+	size_t count;
+	
+	static uintptr_t Key ( void* address ) { return (uintptr_t)address >> GC_CHUNK_SHIFT; }
+	static size_t RootIndex ( uintptr_t key ) { return ROOTBITS > 0 ? (size_t)(key >> (2 * LEVELBITS)) : 0; }
+	static size_t MiddleIndex ( uintptr_t key ) { return (size_t)(key >> LEVELBITS) & (LEVELSIZE - 1); }
+	static size_t LeafIndex ( uintptr_t key ) { return (size_t)key & (LEVELSIZE - 1); }
 public:
-	GCObject ( void* anAddress, void (*aFinaliser)(void*), size_t selfAssignedLen )
-	: address(anAddress),
-	  finaliser(aFinaliser),
-	  condemned(false),
-	  selfAssignedLength(selfAssignedLen)
+	GCChunkMap () : count(0)
 	{
-		ASSERT(anAddress, "object constructed with null address");
-		DEBUG(printf("[GC] +OBJ %p\n", anAddress));
+		root = (Middle* volatile*)calloc(ROOTSIZE, sizeof(Middle*));
+		ASSERT(root, "could not allocate chunk map");
 	}
+	~GCChunkMap () { Clear(); free((void*)root); }
 	
-	~GCObject ()
+	bool Empty () const { return count == 0; }
+	
+	GCChunk* Find ( void* address )
 	{
-		if (finaliser && !disableFinalisers)
-			finaliser(address);
-		for (std::set<GCReference*>::iterator iter = ownedReferences.begin(); iter != ownedReferences.end(); ++iter)
-		{
-			ASSERT(*iter, "null reference found in owned reference list");
-			(*iter)->OwnerDied();
-		}
-		for (std::set<GCReference*>::iterator iter = pointingReferences.begin(); iter != pointingReferences.end(); ++iter)
+		uintptr_t key = Key(address);
+		Middle* middle = AtomicLoadPointer(&root[RootIndex(key)]);
+		if (!middle)
+			return NULL;
+		Leaf* leaf = AtomicLoadPointer(&(*middle)[MiddleIndex(key)]);
+		if (!leaf)
+			return NULL;
+		return AtomicLoadPointer(&(*leaf)[LeafIndex(key)]);
+	}
+	
+	// callers serialise inserts among themselves
+	void Insert ( GCChunk* chunk )
+	{
+		uintptr_t key = Key(chunk);
+		Middle* middle = root[RootIndex(key)];
+		if (!middle)
 		{
-			ASSERT(*iter, "null reference found in pointing reference list");
-			(*iter)->TargetDied();
+			middle = (Middle*)calloc(1, sizeof(Middle));
+			ASSERT(middle, "could not grow chunk map");
+			AtomicStorePointer(&root[RootIndex(key)], middle);
 		}
-		if (selfAssignedLength > 0)
+		Leaf* leaf = (*middle)[MiddleIndex(key)];
+		if (!leaf)
 		{
-			free(address);
+			leaf = (Leaf*)calloc(1, sizeof(Leaf));
+			ASSERT(leaf, "could not grow chunk map");
+			AtomicStorePointer(&(*middle)[MiddleIndex(key)], leaf);
 		}
+		AtomicStorePointer(&(*leaf)[LeafIndex(key)], chunk);
+		count++;
 	}
 	
-	void Migrate ( void* newTarget );
+	// only while no mutator can be looking
+	void Remove ( GCChunk* chunk )
+	{
+		uintptr_t key = Key(chunk);
+		(*(*root[RootIndex(key)])[MiddleIndex(key)])[LeafIndex(key)] = NULL;
+		count--;
+	}
 	
-	void Resize ( size_t len )
+	void Clear ()
 	{
-		ASSERT(selfAssignedLength, "tried to resize non-GC-allocated object");
-		void* newAddress = realloc(address, len);
-		selfAssignedLength = len;
-		if (newAddress != address)
+		for (size_t i = 0; i < ROOTSIZE; i++)
 		{
-			Migrate(newAddress);
+			Middle* middle = root[i];
+			if (!middle)
+				continue;
+			for (size_t j = 0; j < LEVELSIZE; j++)
+				free((void*)(*middle)[j]);
+			free((void*)middle);
+			root[i] = NULL;
 		}
+		count = 0;
 	}
+};
+
+// size-segregated allocator for GC_new_object payloads
+class GCAllocator
+{
+private:
+	enum { SIZECLASSCOUNT = 40, SMALLCLASSCOUNT = 1024 / GC_GRANULE + 1 };
+	size_t classSizes[SIZECLASSCOUNT];
+	int classCount;
+	unsigned char smallClasses[SMALLCLASSCOUNT];
+	GCChunk* available[SIZECLASSCOUNT];
+	GCChunkMap chunks;
+	// buffers are refilled under one lock per size class; chunks only go
+	// back while the world is stopped
+	struct ClassLock
+	{
+		GCMutatorLock lock;
+		char padding[60];
+	};
+	ClassLock classLocks[SIZECLASSCOUNT];
+	GCMutatorLock chunkLock;
 	
-	unsigned long GetLength () { return selfAssignedLength; }
+	int SizeClassFor ( size_t len ) const
+	{
+		if (len <= 1024)
+			return smallClasses[(len + GC_GRANULE - 1) / GC_GRANULE];
+		int low = 0, high = classCount - 1;
+		while (low < high)
+		{
+			int mid = (low + high) / 2;
+			if (classSizes[mid] < len)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		return low;
+	}
 	
-	void Condemn ( GCReference* lastReference );
-	bool IsCondemned () { return condemned; }
+	GCChunk* NewChunk ( int sizeClass, size_t slotSize, size_t len )
+	{
+		char* base = (char*)AllocateAligned(len);
+		ASSERT(base, "could not allocate GC chunk");
+		GCChunk* chunk = (GCChunk*)base;
+		size_t headerSpace = (sizeof(GCChunk) + GC_GRANULE - 1) & ~(GC_GRANULE - 1);
+		size_t slotCount = sizeClass < 0 ? 1 : (len - headerSpace) / (slotSize + sizeof(GCObject*));
+		size_t tableSpace = (slotCount * sizeof(GCObject*) + GC_GRANULE - 1) & ~(GC_GRANULE - 1);
+		chunk->prev = chunk->next = NULL;
+		chunk->sizeClass = sizeClass;
+		chunk->slotSize = slotSize;
+		chunk->slotCount = slotCount;
+		chunk->liveCount = 0;
+		chunk->bumpIndex = 0;
+		chunk->freeSlots = NULL;
+		chunk->owned = false;
+		chunk->headers = (GCObject**)(base + headerSpace);
+		chunk->firstSlot = base + headerSpace + tableSpace;
+		memset(chunk->headers, 0, slotCount * sizeof(GCObject*));
+		chunkLock.Lock();
+		chunks.Insert(chunk);
+		chunkLock.Unlock();
+		return chunk;
+	}
 	
-	void* Address ()
+	void ReleaseChunk ( GCChunk* chunk )
 	{
-		return address;
+		chunks.Remove(chunk);
+		FreeAligned(chunk);
 	}
 	
-	bool IsReferenced ()
+	void LinkAvailable ( GCChunk* chunk )
 	{
-		if (this == rootObject) return true;
-		return !pointingReferences.empty();
+		int sizeClass = chunk->sizeClass;
+		chunk->prev = NULL;
+		chunk->next = available[sizeClass];
+		if (chunk->next)
+			chunk->next->prev = chunk;
+		available[sizeClass] = chunk;
 	}
 	
-	void* GetPointer () { return address; }
-};
-
-class GCField
-{
-private:
-	GCObject* LookupRecursive ( void* ptr )
+	void UnlinkAvailable ( GCChunk* chunk )
 	{
-		std::map<void*, GCObject*>::iterator iter = field.find(ptr);
-		if (iter != field.end())
-			return iter->second;
+		if (chunk->prev)
+			chunk->prev->next = chunk->next;
 		else
-			if (parent)
-				return parent->LookupRecursive(ptr);
-			else
-				return NULL;
+			available[chunk->sizeClass] = chunk->next;
+		if (chunk->next)
+			chunk->next->prev = chunk->prev;
+		chunk->prev = chunk->next = NULL;
 	}
 	
-	static void DoCollection ( std::map<void*, GCObject*>& field, std::map<void*, GCObject*>& targetField, GCField* parent )
+	static bool IsFull ( GCChunk* chunk )
 	{
-		std::set<GCObject*> referencedObjects;
-		std::queue<GCObject*> worklist;
-		// root object is the first one to talk to
-		worklist.push(rootObject);
-		referencedObjects.insert(rootObject);
-		// work through list of all referenced objects
-		while (!worklist.empty())
-		{
-			GCObject* target = worklist.front();
-			ASSERT(target, "null target in DoCollection");
-			worklist.pop();
-			// look through all refs owned by this object
-			for (std::set<GCReference*>::iterator iter = target->ownedReferences.begin(); iter != target->ownedReferences.end(); ++iter)
-			{
-				// this discards weak references
-				GCStrongReference* sr = (*iter)->StrongReference();
-				if (!sr)
-				{
-					continue;
-				}
-				// get the target of this
-				GCObject* liveObject = sr->Target();
-				ASSERT(liveObject, "found null target");
-				if (liveObject == target)
-				{
-					continue; // object is self-referential, early exit
-				}
-				// grab only targets in this field
-				if (field.find(liveObject->Address()) == field.end())
-				{
-					continue;
-				}
-				// if we don't already have it listed, insert it
-				if (referencedObjects.find(liveObject) == referencedObjects.end())
-				{
-					worklist.push(liveObject);
-					referencedObjects.insert(liveObject);
-				}
-			}
-		}
-		// work through all objects
-		disableTrivialExecution = true;
-		for (std::map<void*, GCObject*>::iterator iter = field.begin(); iter != field.end(); ++iter)
-		{
-			GCObject* target = iter->second;
-			ASSERT(target, "found null target in entire object list");
-			// is it trivially referenced
-			bool isReferenced = referencedObjects.find(target) != referencedObjects.end();
-			// if unreferenced, try the parent?
-			if (!isReferenced && parent)
-			{
-				for (std::set<GCReference*>::iterator iter = target->pointingReferences.begin(); iter != target->pointingReferences.end(); ++iter)
-				{
-					GCReference* ref = *iter;
-					ASSERT(ref, "found null reference in pointing reference list");
-					if (ref->IsWeak())
-						continue; // uninterested in weak references
-					// is the ref owner somewhere up in the heirarchy?
-					if (parent->LookupRecursive(ref->Owner()->Address()))
-					{
-						isReferenced = true;
-						break;
-					}
-				}
-			}
-			if (!isReferenced)
-			{
-				// unreferenced
-				ASSERT(target != rootObject, "root object ended up unreferenced?");
-				worklist.push(target);
-			}
-			else
-			{
-				targetField.insert(*iter);
-			}
-		}
-		disableTrivialExecution = false;
-		while (!worklist.empty())
-		{
-			worklist.front()->Condemn(NULL);
-			worklist.pop();
-		}
-		field.clear();
+		return !chunk->freeSlots && chunk->bumpIndex == chunk->slotCount;
 	}
-	std::map<void*, GCObject*> field;
-	GCField* parent;
 public:
-	GCField ( GCField* aParent ) : parent(aParent) {}
-	~GCField ()
+	// the chunk per size class a thread allocates from without taking any lock;
+	// nobody else hands out its slots, and frees only happen with the world stopped
+	struct Buffer
+	{
+		GCChunk* chunks[SIZECLASSCOUNT];
+		bool fresh; // refilled with empty chunks only, so what it hands out stays in order
+		
+		Buffer ( bool onlyFresh = false ) : fresh(onlyFresh) { memset(chunks, 0, sizeof(chunks)); }
+	};
+	
+	GCAllocator ()
 	{
-		for (std::map<void*, GCObject*>::iterator iter = field.begin(); iter != field.end(); iter++)
+		// granule steps up to 128 bytes, then four classes per doubling
+		classCount = 0;
+		for (size_t size = GC_GRANULE; size <= 128; size += GC_GRANULE)
+			classSizes[classCount++] = size;
+		for (size_t base = 128; base < GC_LARGE_OBJECT; base *= 2)
+			for (size_t step = 1; step <= 4; step++)
+				classSizes[classCount++] = base + step * (base / 4);
+		ASSERT(classCount <= SIZECLASSCOUNT, "too many size classes");
+		int sizeClass = 0;
+		for (int i = 0; i < SMALLCLASSCOUNT; i++)
 		{
-			delete iter->second;
+			while (classSizes[sizeClass] < (size_t)i * GC_GRANULE)
+				sizeClass++;
+			smallClasses[i] = (unsigned char)sizeClass;
 		}
-		if (parent) delete parent;
+		for (int i = 0; i < SIZECLASSCOUNT; i++)
+			available[i] = NULL;
 	}
-	void Collect ( int depth )
+	
+	// the slot size a request of this length would be given
+	size_t SlotSizeFor ( size_t len ) const
 	{
-		if (parent)
+		if (len > GC_LARGE_OBJECT)
+			return 0;
+		return classSizes[SizeClassFor(len)];
+	}
+	
+	void* Allocate ( size_t len, GCChunk** owningChunk, Buffer& buffer )
+	{
+		if (len > GC_LARGE_OBJECT)
 		{
-			DoCollection(field, parent->field, parent);
-			ASSERT(field.empty(), "secondary field not empty after collection");
+			size_t headerSpace = (sizeof(GCChunk) + GC_GRANULE - 1) & ~(GC_GRANULE - 1);
+			size_t total = (headerSpace + GC_GRANULE + len + GC_CHUNK_SIZE - 1) & ~(GC_CHUNK_SIZE - 1);
+			GCChunk* chunk = NewChunk(-1, len, total);
+			chunk->liveCount = 1;
+			chunk->bumpIndex = 1;
+			*owningChunk = chunk;
+			return chunk->firstSlot;
 		}
-		else
+		int sizeClass = SizeClassFor(len);
+		GCChunk* chunk = buffer.chunks[sizeClass];
+		if (!chunk || IsFull(chunk))
+			chunk = Refill(buffer, sizeClass);
+		// fresh slots go first: allocation stays sequential and freed
+		// addresses are not handed straight back out
+		void* slot;
+		if (chunk->bumpIndex < chunk->slotCount)
 		{
-			std::map<void*, GCObject*> replacementField;
-			DoCollection(field, replacementField, NULL);
-			field.swap(replacementField);
+			slot = chunk->firstSlot + chunk->bumpIndex * chunk->slotSize;
+			chunk->bumpIndex++;
 		}
-		depth--;
-		if (depth > 0 && parent)
+		else
 		{
-			parent->Collect(depth);
-			ASSERT(field.empty(), "field not empty after parent collection");
+			slot = chunk->freeSlots;
+			chunk->freeSlots = *(void**)slot;
 		}
+		chunk->liveCount++;
+		*owningChunk = chunk;
+		return slot;
 	}
-	void InsertShallow ( GCObject* object )
-	{
-		field[object->Address()] = object;
-	}
-	void InsertDeep ( GCObject* object )
+	
+	// swaps a buffer's exhausted chunk for one with room
+	GCChunk* Refill ( Buffer& buffer, int sizeClass )
 	{
-		if (parent)
-			parent->InsertDeep(object);
+		classLocks[sizeClass].lock.Lock();
+		// a full chunk belongs to no list; Free puts it back on one when a slot comes free
+		if (buffer.chunks[sizeClass])
+			buffer.chunks[sizeClass]->owned = false;
+		GCChunk* chunk = buffer.fresh ? NULL : available[sizeClass];
+		if (chunk)
+			UnlinkAvailable(chunk);
 		else
-			InsertShallow(object);
-	}
-	GCObject* Lookup ( void* ptr )
-	{
-		return LookupRecursive(ptr);
+			chunk = NewChunk(sizeClass, classSizes[sizeClass], GC_CHUNK_SIZE);
+		chunk->owned = true;
+		buffer.chunks[sizeClass] = chunk;
+		classLocks[sizeClass].lock.Unlock();
+		return chunk;
 	}
-	void Remove ( GCObject* obj )
+	
+	// hands a buffer's chunks back, for a thread going away or a heap shutting down
+	void Retire ( Buffer& buffer )
 	{
-		ASSERT(!disableTrivialExecution, "Remove() called with TE disabled");
-		std::map<void*, GCObject*>::iterator iter = field.find(obj->Address());
-		if (iter != field.end())
-			field.erase(iter);
-		else if (parent)
-			parent->Remove(obj);
+		for (int i = 0; i < SIZECLASSCOUNT; i++)
+		{
+			GCChunk* chunk = buffer.chunks[i];
+			if (!chunk)
+				continue;
+			classLocks[i].lock.Lock();
+			chunk->owned = false;
+			if (!IsFull(chunk))
+				LinkAvailable(chunk);
+			classLocks[i].lock.Unlock();
+			buffer.chunks[i] = NULL;
+		}
 	}
-	void Move ( void* oldAddress, void* newAddress )
+	
+	void Free ( GCChunk* chunk, void* slot )
 	{
-		std::map<void*, GCObject*>::iterator iter = field.find(oldAddress);
-		if (iter == field.end())
+		chunk->SetObject(slot, NULL);
+		if (chunk->sizeClass < 0)
 		{
-			if (parent)
-			{
-				parent->Move(oldAddress, newAddress);
-			}
+			ReleaseChunk(chunk);
+			return;
 		}
+		bool wasFull = IsFull(chunk);
+		*(void**)slot = chunk->freeSlots;
+		chunk->freeSlots = slot;
+		chunk->liveCount--;
+		// its thread carries on allocating from it
+		if (chunk->owned)
+			return;
+		if (wasFull)
+			LinkAvailable(chunk);
+		// hand empty chunks back unless they are the last one for their class
+		if (chunk->liveCount == 0 && (chunk->prev || chunk->next))
+		{
+			UnlinkAvailable(chunk);
+			ReleaseChunk(chunk);
+		}
+	}
+	
+	GCChunk* ChunkFor ( void* ptr )
+	{
+		return chunks.Find(ptr);
+	}
+	
+	void ReleaseAll ()
+	{
+		for (int i = 0; i < SIZECLASSCOUNT; i++)
+		{
+			while (available[i])
+			{
+				GCChunk* chunk = available[i];
+				UnlinkAvailable(chunk);
+				ReleaseChunk(chunk);
+			}
+		}
+		ASSERT(chunks.Empty(), "chunks still live at shutdown");
+		chunks.Clear();
+	}
+};
+
+GCAllocator allocator;
+
+// strong and weak references share one layout, told apart by a flag bit
+class GCReference
+{
+private:
+	GCObject* owner;
+	GCObject* target;
+	void** pointerLocation;
+	unsigned flags;
+public:
+	enum
+	{
+		WEAK = 1,
+		PENDING = 2, // a new object's first edge, on its thread's list until the next safepoint
+		DROPPED = 4 // taken out again while pending, and freed at the safepoint
+	};
+	
+	// intrusive links: one pair threads the owner's owned list, the other the target's pointing list
+	GCReference* ownedPrev;
+	GCReference* ownedNext;
+	GCReference* pointingPrev;
+	GCReference* pointingNext;
+
+	GCReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation, unsigned someFlags );
+	~GCReference ();
+	
+	void** PointerLocation () const { return pointerLocation; }
+	void SetPointerLocation ( void** aPointerLocation ) { pointerLocation = aPointerLocation; }
+	GCObject* Owner () const { return owner; }
+	GCObject* Target () const { return target; }
+	GCReference* NextOwned () const { return ownedNext; }
+	GCReference* NextPointing () const { return pointingNext; }
+	bool IsWeak () const { return flags & WEAK; }
+	bool IsPending () const { return flags & PENDING; }
+	bool IsDropped () const { return flags & DROPPED; }
+	void SetPending ( bool pending ) { flags = pending ? flags | PENDING : flags & ~PENDING; }
+	void Drop () { flags |= DROPPED; }
+	
+	void OwnerDied ();
+	void TargetDied ();
+	
+	static void* operator new ( size_t size );
+	static void operator delete ( void* ptr );
+};
+
+#define GC_EDGE_INDEX_SCAN 32
+
+// a hub's owned references by target, so taking one of many out does not walk
+// them all; a multiset, since the same edge may be registered more than once
+class GCEdgeIndex
+{
+private:
+	GCReference** slots;
+	size_t mask;
+	size_t count;
+	
+	size_t Hash ( GCObject* target ) const
+	{
+		uint64_t key = (uint64_t)(uintptr_t)target;
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return (size_t)key & mask;
+	}
+	
+	void Place ( GCReference* ref )
+	{
+		size_t i = Hash(ref->Target());
+		while (slots[i])
+			i = (i + 1) & mask;
+		slots[i] = ref;
+	}
+	
+	void Grow ()
+	{
+		GCReference** oldSlots = slots;
+		size_t oldCapacity = mask + 1;
+		mask = (oldCapacity << 1) - 1;
+		slots = (GCReference**)calloc(mask + 1, sizeof(GCReference*));
+		ASSERT(slots, "could not grow edge index");
+		for (size_t i = 0; i < oldCapacity; i++)
+		{
+			if (oldSlots[i])
+				Place(oldSlots[i]);
+		}
+		free(oldSlots);
+	}
+public:
+	GCEdgeIndex () : mask(GC_EDGE_INDEX_SCAN * 2 - 1), count(0)
+	{
+		slots = (GCReference**)calloc(mask + 1, sizeof(GCReference*));
+		ASSERT(slots, "could not allocate edge index");
+	}
+	~GCEdgeIndex () { free(slots); }
+	
+	void Insert ( GCReference* ref )
+	{
+		if ((count + 1) * 2 > mask + 1)
+			Grow();
+		Place(ref);
+		count++;
+	}
+	
+	// one without a pointer location if there is one
+	GCReference* Find ( GCObject* target, bool isWeak ) const
+	{
+		GCReference* found = NULL;
+		for (size_t i = Hash(target); slots[i]; i = (i + 1) & mask)
+		{
+			if (slots[i]->Target() != target || slots[i]->IsWeak() != isWeak)
+				continue;
+			if (!slots[i]->PointerLocation())
+				return slots[i];
+			if (!found)
+				found = slots[i];
+		}
+		return found;
+	}
+	
+	void Remove ( GCReference* ref )
+	{
+		size_t i = Hash(ref->Target());
+		while (slots[i] != ref)
+		{
+			ASSERT(slots[i], "reference missing from edge index");
+			i = (i + 1) & mask;
+		}
+		// backward-shift deletion, as in GCAddressMap
+		for (;;)
+		{
+			slots[i] = NULL;
+			size_t j = i;
+			for (;;)
+			{
+				j = (j + 1) & mask;
+				if (!slots[j])
+				{
+					count--;
+					return;
+				}
+				size_t home = Hash(slots[j]->Target());
+				// leave it where it is if its home lies cyclically within (i, j]
+				if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+					continue;
+				break;
+			}
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+};
+
+GCObject* rootObject;
+
+void ForgetReleased ( GCObject* object );
+void ForgetRemembered ( GCObject* object );
+void ReleaseHandle ( uint32_t slot );
+void AccountFreed ( int64_t bytes );
+bool QueueFinaliser ( void (*finaliser)(void*), void* address, GCChunk* chunk, size_t length );
+unsigned finaliserDepth = 0; // finalisers running on the collecting thread
+GCAllocator::Buffer& AllocationBuffer ();
+void AccountResized ( int generation, int64_t bytes );
+
+// tallies kept by whichever thread does the work, on a record of its own, and
+// summed when read; only changed with the heap locked
+struct GCCounters
+{
+	// signed, since a thread may drop references another made
+	int64_t strongReferences;
+	int64_t weakReferences;
+	uint64_t finalised;
+	
+	GCCounters () : strongReferences(0), weakReferences(0), finalised(0) {}
+};
+
+GCCounters& Counters ();
+
+#define GC_REMEMBER_PENDING 0xFFFFFFFFu
+
+class GCObject
+{
+private:
+	void* address;
+	void (*finaliser)(void*);
+	bool condemned;
+	bool evacuating; // due to be copied out of the youngest field
+	uint8_t age; // collections survived in its current field
+	bool pendingEdge; // its first edge waits on a thread's list, at the head of its pointing list
+	uint32_t handleSlot; // 1 + its slot in the handle table, or 0
+	size_t selfAssignedLength;
+	GCChunk* chunk; // set when the payload lives in a GC chunk slot
+	GCReference* pointingReferences;
+	GCReference* ownedReferences;
+	GCEdgeIndex* ownedIndex; // only for objects that have been searched for an edge at length
+	int generation;
+	uint32_t markEpoch;
+	uint32_t releaseQueued; // sitting in a list of objects to recheck for release
+	uint32_t rememberedSlot; // 1 + index in its field's remembered set, GC_REMEMBER_PENDING, or 0
+public:
+	// intrusive links for the object list of the field it lives in
+	GCObject* fieldPrev;
+	GCObject* fieldNext;
+
+	GCObject ( void* anAddress, void (*aFinaliser)(void*), size_t selfAssignedLen, GCChunk* aChunk )
+	: address(anAddress),
+	  finaliser(aFinaliser),
+	  condemned(false),
+	  evacuating(false),
+	  age(0),
+	  pendingEdge(false),
+	  handleSlot(0),
+	  selfAssignedLength(selfAssignedLen),
+	  chunk(aChunk),
+	  pointingReferences(NULL),
+	  ownedReferences(NULL),
+	  ownedIndex(NULL),
+	  generation(-1),
+	  markEpoch(0),
+	  releaseQueued(0),
+	  rememberedSlot(0),
+	  fieldPrev(NULL),
+	  fieldNext(NULL)
+	{
+		ASSERT(anAddress, "object constructed with null address");
+		DEBUG(printf("[GC] +OBJ %p\n", anAddress));
+	}
+	
+	~GCObject ()
+	{
+		if (releaseQueued)
+			ForgetReleased(this);
+		if (rememberedSlot && !shuttingDown)
+			ForgetRemembered(this);
+		if (handleSlot)
+			ReleaseHandle(handleSlot - 1);
+		Finalise();
+		Detach();
+		if (chunk)
+		{
+			allocator.Free(chunk, address);
+		}
+		else if (selfAssignedLength > 0)
+		{
+			free(address);
+		}
+		if (selfAssignedLength > 0)
+			AccountFreed(selfAssignedLength);
+	}
+	
+	static void* operator new ( size_t size );
+	static void operator delete ( void* ptr );
+	
+	// runs the finaliser, at most once; reclamation gets through a batch of these
+	// before it unlinks or frees any of the objects in it. True if it was called here
+	bool Finalise ()
+	{
+		void (*call)(void*) = finaliser;
+		finaliser = NULL;
+		if (!call || disableFinalisers)
+			return false;
+		// a queued call takes the payload with it, to be freed once it has been made
+		if (QueueFinaliser(call, address, chunk, selfAssignedLength))
+		{
+			chunk = NULL;
+			selfAssignedLength = 0;
+			return false;
+		}
+		finaliserDepth++;
+		call(address);
+		finaliserDepth--;
+		Counters().finalised++;
+		return true;
+	}
+	
+	// unlinks every reference from and to it
+	void Detach ()
+	{
+		delete ownedIndex;
+		ownedIndex = NULL;
+		// always take from the head: handlers may cascade and unlink other entries
+		GCReference* ref;
+		while ((ref = ownedReferences))
+		{
+			RemoveOwnedReference(ref);
+			ref->OwnerDied();
+		}
+		while ((ref = pointingReferences))
+		{
+			RemovePointingReference(ref);
+			ref->TargetDied();
+		}
+	}
+	
+	GCReference* OwnedReferences () const { return ownedReferences; }
+	GCReference* PointingReferences () const { return pointingReferences; }
+	GCReference* PendingEdge () const { return pendingEdge ? pointingReferences : NULL; }
+	void SetPendingEdge ( bool pending ) { pendingEdge = pending; }
+	
+	void AddOwnedReference ( GCReference* ref )
+	{
+		ref->ownedPrev = NULL;
+		ref->ownedNext = ownedReferences;
+		if (ownedReferences)
+			ownedReferences->ownedPrev = ref;
+		ownedReferences = ref;
+		if (ownedIndex)
+			ownedIndex->Insert(ref);
+	}
+	
+	void RemoveOwnedReference ( GCReference* ref )
+	{
+		ASSERT(ref->Owner() == this, "reference isn't in owned list");
+		if (ref->ownedPrev)
+			ref->ownedPrev->ownedNext = ref->ownedNext;
+		else
+			ownedReferences = ref->ownedNext;
+		if (ref->ownedNext)
+			ref->ownedNext->ownedPrev = ref->ownedPrev;
+		ref->ownedPrev = ref->ownedNext = NULL;
+		if (ownedIndex)
+		{
+			ownedIndex->Remove(ref);
+			// an emptied container gives the index back
+			if (!ownedReferences)
+			{
+				delete ownedIndex;
+				ownedIndex = NULL;
+			}
+		}
+	}
+	
+	// an owned reference to the target, of the given kind, or NULL; one without a
+	// pointer location goes first, since it is what pins the target in place. A
+	// search that has to walk far indexes the owned list, so the next one takes
+	// constant time
+	GCReference* FindOwnedReference ( GCObject* target, bool isWeak )
+	{
+		if (ownedIndex)
+			return ownedIndex->Find(target, isWeak);
+		unsigned walked = 0;
+		GCReference* found = NULL;
+		for (GCReference* ref = ownedReferences; ref; ref = ref->NextOwned(), walked++)
+		{
+			if (ref->Target() != target || ref->IsWeak() != isWeak)
+				continue;
+			if (!found)
+				found = ref;
+			if (!ref->PointerLocation())
+			{
+				found = ref;
+				break;
+			}
+		}
+		if (walked >= GC_EDGE_INDEX_SCAN)
+		{
+			ownedIndex = new GCEdgeIndex;
+			for (GCReference* owned = ownedReferences; owned; owned = owned->NextOwned())
+				ownedIndex->Insert(owned);
+		}
+		return found;
+	}
+	
+	// whether every reference to it says where its address is kept, so that it can
+	// be moved; the root holds what the mutator keeps out of sight
+	bool Movable () const
+	{
+		if (!chunk || chunk->sizeClass < 0)
+			return false;
+		for (GCReference* ref = pointingReferences; ref; ref = ref->NextPointing())
+		{
+			if (!ref->PointerLocation())
+				return false;
+		}
+		return true;
+	}
+	
+	void AddPointingReference ( GCReference* ref )
+	{
+		// a pending edge keeps the head, so it can be found without a search
+		GCReference** head = pendingEdge ? &pointingReferences->pointingNext : &pointingReferences;
+		ref->pointingPrev = pendingEdge ? pointingReferences : NULL;
+		ref->pointingNext = *head;
+		if (*head)
+			(*head)->pointingPrev = ref;
+		*head = ref;
+	}
+	
+	void RemovePointingReference ( GCReference* ref )
+	{
+		ASSERT(ref->Target() == this, "reference isn't in pointing list");
+		if (ref->pointingPrev)
+			ref->pointingPrev->pointingNext = ref->pointingNext;
+		else
+			pointingReferences = ref->pointingNext;
+		if (ref->pointingNext)
+			ref->pointingNext->pointingPrev = ref->pointingPrev;
+		ref->pointingPrev = ref->pointingNext = NULL;
+	}
+	
+	void Migrate ( void* newTarget, GCChunk* newChunk );
+	
+	void Resize ( size_t len )
+	{
+		ASSERT(selfAssignedLength, "tried to resize non-GC-allocated object");
+		AccountFreed((int64_t)selfAssignedLength - (int64_t)len);
+		AccountResized(generation, (int64_t)len - (int64_t)selfAssignedLength);
+		if (!chunk)
+		{
+			void* newAddress = realloc(address, len);
+			selfAssignedLength = len;
+			if (newAddress != address)
+			{
+				Migrate(newAddress, NULL);
+			}
+			return;
+		}
+		if (allocator.SlotSizeFor(len) == chunk->slotSize && chunk->sizeClass >= 0)
+		{
+			selfAssignedLength = len;
+			return;
+		}
+		GCChunk* newChunk;
+		void* newAddress = allocator.Allocate(len, &newChunk, AllocationBuffer());
+		memcpy(newAddress, address, len < selfAssignedLength ? len : selfAssignedLength);
+		selfAssignedLength = len;
+		Migrate(newAddress, newChunk);
+	}
+	
+	unsigned long GetLength () { return selfAssignedLength; }
+	GCChunk* Chunk () const { return chunk; }
+	
+	int Generation () const { return generation; }
+	void SetGeneration ( int aGeneration ) { generation = aGeneration; }
+	// counts one more collection survived; the count saturates
+	unsigned Survive () { return age < 255 ? ++age : age; }
+	void ResetAge () { age = 0; }
+	
+	// stamps the object for this collection; false if it already was
+	bool Mark ( unsigned epoch )
+	{
+		if (markEpoch == epoch)
+			return false;
+		markEpoch = epoch;
+		return true;
+	}
+	bool IsMarked ( unsigned epoch ) const { return markEpoch == epoch; }
+	// as Mark, but safe against other marking threads
+	bool MarkShared ( unsigned epoch )
+	{
+		uint32_t oldEpoch = AtomicLoad(&markEpoch);
+		if (oldEpoch == epoch)
+			return false;
+		return AtomicCAS(&markEpoch, oldEpoch, epoch);
+	}
+	// the mark word, lent between collections to a traversal that numbers objects;
+	// 0 is free to mean unnumbered, since no collection uses it as its epoch
+	uint32_t Number () const { return markEpoch; }
+	void SetNumber ( uint32_t number ) { markEpoch = number; }
+	
+	void Condemn ();
+	void SetCondemned () { condemned = true; }
+	bool Evacuating () const { return evacuating; }
+	void SetEvacuating ( bool flag ) { evacuating = flag; }
+	bool IsCondemned () { return condemned; }
+	
+	// false if it was already waiting for a recheck
+	bool QueueRelease () { return AtomicCAS(&releaseQueued, 0, 1); }
+	void ClearRelease () { AtomicStore(&releaseQueued, 0); }
+	
+	uint32_t HandleSlot () { return AtomicLoad(&handleSlot); }
+	// false if another thread gave it a handle first
+	bool ClaimHandle ( uint32_t slot ) { return AtomicCAS(&handleSlot, 0, slot + 1); }
+	
+	uint32_t RememberedSlot () { return AtomicLoad(&rememberedSlot); }
+	void SetRememberedSlot ( uint32_t slot ) { rememberedSlot = slot; }
+	// false if it was already remembered, or on its way
+	bool ClaimRemembered () { return AtomicCAS(&rememberedSlot, 0, GC_REMEMBER_PENDING); }
+	
+	void* Address ()
+	{
+		return address;
+	}
+	
+	bool HasFinaliser () const { return finaliser != NULL; }
+	
+	bool IsReferenced ()
+	{
+		if (this == rootObject) return true;
+		return pointingReferences != NULL;
+	}
+	
+	void* GetPointer () { return address; }
+};
+
+#ifdef SINGLE_THREADED
+GCPool objectPool(sizeof(GCObject));
+GCPool referencePool(sizeof(GCReference));
+
+class GCLock
+{
+public:
+	GCLock () {}
+	~GCLock () {}
+	bool HeldExclusively () { return true; }
+	void ReadLock () {}
+	void ReadUnlock () {}
+	void WriteLock () {}
+	void WriteUnlock () {}
+};
+#else
+#define GC_CACHE_BATCH 64
+#define GC_RELEASE_BATCH 256
+
+// a pool that threads draw on through caches of their own
+struct GCSharedPool
+{
+	GCPool pool;
+	GCSpinLock lock;
+	GCSharedPool ( size_t cellSize ) : pool(cellSize) {}
+};
+
+GCSharedPool objectPool(sizeof(GCObject));
+GCSharedPool referencePool(sizeof(GCReference));
+
+// free cells a thread keeps in front of a shared pool; they move to and from
+// the pool in batches, so its lock is taken once per batch rather than per cell
+class GCCellCache
+{
+private:
+	struct Cell
+	{
+		Cell* next;
+	};
+	Cell* cells;
+	unsigned count;
+	
+	void Push ( void* ptr )
+	{
+		Cell* cell = (Cell*)ptr;
+		cell->next = cells;
+		cells = cell;
+		count++;
+	}
+	
+	void* Pop ()
+	{
+		Cell* cell = cells;
+		cells = cell->next;
+		count--;
+		return cell;
+	}
+public:
+	GCCellCache () : cells(NULL), count(0) {}
+	
+	void* Allocate ( GCSharedPool& shared )
+	{
+		if (!cells)
+		{
+			shared.lock.Lock();
+			for (unsigned i = 0; i < GC_CACHE_BATCH; i++)
+				Push(shared.pool.Allocate());
+			shared.lock.Unlock();
+		}
+		return Pop();
+	}
+	
+	void Free ( GCSharedPool& shared, void* ptr )
+	{
+		Push(ptr);
+		if (count > 2 * GC_CACHE_BATCH)
+			Flush(shared, GC_CACHE_BATCH);
+	}
+	
+	void Flush ( GCSharedPool& shared, unsigned keep )
+	{
+		shared.lock.Lock();
+		while (count > keep)
+			shared.pool.Free(Pop());
+		shared.lock.Unlock();
+	}
+	
+	// the pool is about to release its blocks wholesale
+	void Drop ()
+	{
+		cells = NULL;
+		count = 0;
+	}
+};
+
+// what the heap keeps about each mutator thread; records are recycled when
+// threads exit but never freed, so the collector can walk them without locking
+struct GCThread
+{
+	volatile uint32_t active; // inside a read section
+	volatile uint32_t attached;
+	unsigned readDepth;
+	GCThread* next;
+	GCCellCache objectCells;
+	GCCellCache referenceCells;
+	GCAllocator::Buffer allocation;
+	// objects made since the last safepoint, linked through their field links
+	GCObject* nurseryHead;
+	GCObject* nurseryTail;
+	size_t nurseryCount;
+	size_t nurseryBytes;
+	// objects that may have lost their last reference, rechecked under the write lock
+	std::vector<GCObject*> released;
+	// objects shaded by this thread's write barrier, picked up by the next collection step
+	std::vector<GCObject*> grey;
+	// objects this thread gave a reference from an older generation, filed at the next safepoint
+	std::vector<GCObject*> remembered;
+	// the first edges of new objects, linked through their owned links and added
+	// to their owners' lists at the next safepoint
+	GCReference* pendingEdges;
+	// allocation not yet added to the shared accounting
+	int64_t pendingBytes;
+	int64_t pendingObjects;
+	GCCounters counters;
+	char padding[64];
+	
+	GCThread () : active(0), attached(0), readDepth(0), next(NULL), nurseryHead(NULL), nurseryTail(NULL), nurseryCount(0), nurseryBytes(0), pendingEdges(NULL), pendingBytes(0), pendingObjects(0) {}
+};
+
+GCThread* volatile threads = NULL;
+pthread_mutex_t threadsMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+pthread_key_t threadKey;
+__thread GCThread* currentThread = NULL;
+
+static void DetachThread ( void* context );
+
+static void CreateThreadKey ()
+{
+	pthread_key_create(&threadKey, DetachThread);
+}
+
+static GCThread* AttachThread ()
+{
+	pthread_once(&threadKeyOnce, CreateThreadKey);
+	pthread_mutex_lock(&threadsMutex);
+	GCThread* thread;
+	for (thread = threads; thread; thread = thread->next)
+	{
+		if (!AtomicLoad(&thread->attached))
+			break;
+	}
+	if (!thread)
+	{
+		thread = new GCThread;
+		thread->next = threads;
+		AtomicStorePointer(&threads, thread);
+	}
+	AtomicStore(&thread->attached, 1);
+	pthread_mutex_unlock(&threadsMutex);
+	pthread_setspecific(threadKey, thread);
+	currentThread = thread;
+	return thread;
+}
+
+inline GCThread* CurrentThread ()
+{
+	GCThread* thread = currentThread;
+	return thread ? thread : AttachThread();
+}
+
+// mutators only ever raise a flag of their own, so read sections on different
+// threads share no cache lines; a writer asks everyone to stop and waits for
+// the flags to drop. The writing thread may re-enter either side, which is
+// what finalisers and weak invalidators calling back into the API rely on.
+class GCLock
+{
+private:
+	pthread_mutex_t writeMutex;
+	volatile uint32_t stopRequested;
+	GCThread* volatile writer;
+	unsigned writeDepth;
+public:
+	GCLock () : stopRequested(0), writer(NULL), writeDepth(0) { pthread_mutex_init(&writeMutex, NULL); }
+	~GCLock () { pthread_mutex_destroy(&writeMutex); }
+	
+	bool HeldExclusively ()
+	{
+		return AtomicLoadPointer(&writer) == CurrentThread();
+	}
+	
+	void ReadLock ()
+	{
+		GCThread* self = CurrentThread();
+		if (self->readDepth++ > 0 || AtomicLoadPointer(&writer) == self)
+			return;
+		for (;;)
+		{
+			AtomicStore(&self->active, 1);
+			AtomicFence();
+			if (!AtomicLoad(&stopRequested))
+				break;
+			AtomicStore(&self->active, 0);
+			WAITCONDITION(!AtomicLoad(&stopRequested));
+		}
+		DEBUG(printf("[GC] +LK RD\n"));
+	}
+	
+	void ReadUnlock ()
+	{
+		GCThread* self = CurrentThread();
+		ASSERT(self->readDepth > 0, "unlocking already unlocked read lock");
+		if (--self->readDepth > 0 || AtomicLoadPointer(&writer) == self)
+			return;
+		AtomicStore(&self->active, 0);
+		DEBUG(printf("[GC] -LK RD\n"));
+	}
+	
+	void WriteLock ()
+	{
+		GCThread* self = CurrentThread();
+		if (AtomicLoadPointer(&writer) == self)
+		{
+			writeDepth++;
+			return;
+		}
+		ASSERT(self->readDepth == 0, "write lock requested inside a read section");
+		pthread_mutex_lock(&writeMutex);
+		AtomicStore(&stopRequested, 1);
+		AtomicFence();
+		for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+			WAITCONDITION(!AtomicLoad(&thread->active));
+		AtomicStorePointer(&writer, self);
+		writeDepth = 1;
+		DEBUG(printf("[GC] +LK WR\n"));
+	}
+	
+	void WriteUnlock ()
+	{
+		ASSERT(writer == CurrentThread(), "unlocked write lock not held");
+		if (--writeDepth > 0)
+			return;
+		AtomicStorePointer(&writer, (GCThread*)NULL);
+		AtomicStore(&stopRequested, 0);
+		pthread_mutex_unlock(&writeMutex);
+		DEBUG(printf("[GC] -LK WR\n"));
+	}
+};
+#endif
+
+GCLock globalLock;
+
+#ifdef SINGLE_THREADED
+GCAllocator::Buffer allocationBuffer;
+GCCounters counters;
+
+GCAllocator::Buffer& AllocationBuffer ()
+{
+	return allocationBuffer;
+}
+
+GCCounters& Counters ()
+{
+	return counters;
+}
+#else
+GCAllocator::Buffer& AllocationBuffer ()
+{
+	return CurrentThread()->allocation;
+}
+
+GCCounters& Counters ()
+{
+	return CurrentThread()->counters;
+}
+
+static void DetachThread ( void* context )
+{
+	GCThread* thread = (GCThread*)context;
+	// its nursery objects stay put until the next safepoint adopts them
+	globalLock.ReadLock();
+	allocator.Retire(thread->allocation);
+	globalLock.ReadUnlock();
+	thread->objectCells.Flush(objectPool, 0);
+	thread->referenceCells.Flush(referencePool, 0);
+	currentThread = NULL;
+	AtomicStore(&thread->attached, 0);
+}
+#endif
+
+void* GCObject::operator new ( size_t size )
+{
+	ASSERT(size == sizeof(GCObject), "GCObject allocated with odd size");
+	(void)size;
+#ifdef SINGLE_THREADED
+	return objectPool.Allocate();
+#else
+	return CurrentThread()->objectCells.Allocate(objectPool);
+#endif
+}
+
+void GCObject::operator delete ( void* ptr )
+{
+#ifdef SINGLE_THREADED
+	objectPool.Free(ptr);
+#else
+	CurrentThread()->objectCells.Free(objectPool, ptr);
+#endif
+}
+
+#define GC_ACCOUNT_BYTES 65536
+#define GC_ACCOUNT_OBJECTS 1024
+#define GC_FULL_HEAP_FLOOR ((int64_t)1 << 20)
+
+// counts what is allocated and freed, and decides when that calls for a collection:
+// a partial one once the nursery budget is spent, a full one once the heap has
+// grown by the configured factor over what the last full collection left live.
+// Threads add their allocation in batches, so the budgets are approximate.
+class GCTriggers
+{
+public:
+	enum Collection
+	{
+		NONE,
+		PARTIAL,
+		FULL
+	};
+private:
+	volatile int64_t nurseryBytes; // since the last collection
+	volatile int64_t nurseryObjects;
+	volatile int64_t heapBytes; // allocated and not yet freed
+	int64_t fullThreshold;
+	int64_t liveBytes; // heap left by the last full collection
+	volatile uint32_t due;
+	GC_triggers limits;
+	
+	void SetThreshold ()
+	{
+		int64_t base = liveBytes > GC_FULL_HEAP_FLOOR ? liveBytes : GC_FULL_HEAP_FLOOR;
+		fullThreshold = base + base / 100 * limits.heapGrowth;
+	}
+	
+	// false if nothing is due
+	bool Add ( int64_t bytes, int64_t objects )
+	{
+#ifndef SINGLE_THREADED
+		int64_t nursery = AtomicAdd64(&nurseryBytes, bytes);
+		int64_t count = AtomicAdd64(&nurseryObjects, objects);
+		int64_t heap = AtomicAdd64(&heapBytes, bytes);
+#else
+		int64_t nursery = nurseryBytes += bytes;
+		int64_t count = nurseryObjects += objects;
+		int64_t heap = heapBytes += bytes;
+#endif
+		uint32_t wanted = NONE;
+		if (limits.heapGrowth && heap >= fullThreshold)
+			wanted = FULL;
+		else if ((limits.nurseryBytes && nursery >= (int64_t)limits.nurseryBytes) || (limits.nurseryObjects && count >= (int64_t)limits.nurseryObjects))
+			wanted = PARTIAL;
+		if (wanted == NONE)
+			return false;
+		uint32_t current;
+		while ((current = AtomicLoad(&due)) < wanted && !AtomicCAS(&due, current, wanted))
+			;
+		return true;
+	}
+public:
+	GCTriggers () : nurseryBytes(0), nurseryObjects(0), heapBytes(0), fullThreshold(0), liveBytes(0), due(NONE)
+	{
+		memset(&limits, 0, sizeof(limits));
+	}
+	
+	// starts afresh; needs the write lock, like everything else that changes the limits
+	void Reset ( const GC_triggers& someLimits )
+	{
+		nurseryBytes = nurseryObjects = heapBytes = liveBytes = 0;
+		due = NONE;
+		Set(someLimits);
+	}
+	
+	void Set ( const GC_triggers& someLimits )
+	{
+		limits = someLimits;
+		SetThreshold();
+	}
+	
+	const GC_triggers& Limits () const { return limits; }
+	
+	// true if a collection is now due
+	bool Allocated ( size_t bytes )
+	{
+#ifndef SINGLE_THREADED
+		GCThread* thread = CurrentThread();
+		thread->pendingBytes += bytes;
+		// a flush at a safepoint may have made a collection due in the meantime
+		if (++thread->pendingObjects < GC_ACCOUNT_OBJECTS && thread->pendingBytes < GC_ACCOUNT_BYTES)
+			return AtomicLoad(&due) != NONE;
+		int64_t objects = thread->pendingObjects;
+		bytes = thread->pendingBytes;
+		thread->pendingBytes = thread->pendingObjects = 0;
+		return Add(bytes, objects);
+#else
+		return Add(bytes, 1);
+#endif
+	}
+	
+	// folds in what a thread has not yet added; needs the write lock. Whatever
+	// collection that makes due is run by the thread's next allocation.
+	void Flush ( int64_t& bytes, int64_t& objects )
+	{
+		if (bytes || objects)
+			Add(bytes, objects);
+		bytes = objects = 0;
+	}
+	
+	// only ever called with the write lock held
+	void Freed ( int64_t bytes ) { heapBytes -= bytes; }
+	
+	Collection TakeDue ()
+	{
+		return (Collection)__sync_lock_test_and_set(&due, NONE);
+	}
+	
+	// needs the write lock
+	void Collected ( bool full )
+	{
+		nurseryBytes = nurseryObjects = 0;
+		if (full)
+		{
+			liveBytes = heapBytes;
+			SetThreshold();
+		}
+	}
+};
+
+GCTriggers triggers;
+
+void AccountFreed ( int64_t bytes )
+{
+	triggers.Freed(bytes);
+}
+
+#ifdef SINGLE_THREADED
+#define GC_EDGE_STRIPES 1
+#define GC_INDEX_SHARDS 1
+#else
+#define GC_EDGE_STRIPES 1024
+#define GC_INDEX_SHARDS 64
+#endif
+
+// striped locks over the reference lists; changing an edge takes the stripes
+// of both ends, lower index first
+class GCEdgeLocks
+{
+private:
+	struct Stripe
+	{
+		GCMutatorLock lock;
+		char padding[60];
+	};
+	Stripe stripes[GC_EDGE_STRIPES];
+	
+	static unsigned StripeFor ( GCObject* object )
+	{
+		uint32_t hash = (uint32_t)((uintptr_t)object >> 4) * 2654435761u;
+		return (hash >> 16) % GC_EDGE_STRIPES;
+	}
+public:
+	void Lock ( GCObject* a, GCObject* b )
+	{
+		unsigned i = StripeFor(a), j = StripeFor(b);
+		stripes[i < j ? i : j].lock.Lock();
+		if (i != j)
+			stripes[i < j ? j : i].lock.Lock();
+	}
+	
+	void Unlock ( GCObject* a, GCObject* b )
+	{
+		unsigned i = StripeFor(a), j = StripeFor(b);
+		if (i != j)
+			stripes[i < j ? j : i].lock.Unlock();
+		stripes[i < j ? i : j].lock.Unlock();
+	}
+};
+
+GCEdgeLocks edgeLocks;
+
+// the hash index for objects outside GC chunks, split into separately locked shards
+class GCObjectIndex
+{
+private:
+	struct Shard
+	{
+		GCAddressMap<GCObject> map;
+		GCMutatorLock lock;
+		char padding[60];
+	};
+	Shard shards[GC_INDEX_SHARDS];
+	
+	Shard& ShardFor ( void* address )
+	{
+		return shards[((uintptr_t)address >> 4) % GC_INDEX_SHARDS];
+	}
+public:
+	GCObject* Find ( void* address )
+	{
+		Shard& shard = ShardFor(address);
+		shard.lock.Lock();
+		GCObject* object = shard.map.Find(address);
+		shard.lock.Unlock();
+		return object;
+	}
+	
+	void Insert ( void* address, GCObject* object )
+	{
+		Shard& shard = ShardFor(address);
+		shard.lock.Lock();
+		shard.map.Insert(address, object);
+		shard.lock.Unlock();
+	}
+	
+	void Remove ( void* address )
+	{
+		Shard& shard = ShardFor(address);
+		shard.lock.Lock();
+		shard.map.Remove(address);
+		shard.lock.Unlock();
+	}
+	
+	void Clear ()
+	{
+		for (int i = 0; i < GC_INDEX_SHARDS; i++)
+			shards[i].map.Clear();
+	}
+};
+
+// objects in GC chunks are found by address arithmetic, everything else by hash
+GCObjectIndex objectIndex;
+
+GCObject* FindObject ( void* ptr )
+{
+	GCChunk* chunk = allocator.ChunkFor(ptr);
+	if (chunk)
+	{
+		GCObject* object = chunk->ObjectAt(ptr);
+		if (object)
+			return object;
+	}
+	return objectIndex.Find(ptr);
+}
+
+void IndexObject ( GCObject* object )
+{
+	if (object->Chunk())
+		object->Chunk()->SetObject(object->Address(), object);
+	else
+		objectIndex.Insert(object->Address(), object);
+}
+
+void UnindexObject ( GCObject* object )
+{
+	if (object->Chunk())
+		object->Chunk()->SetObject(object->Address(), NULL);
+	else
+		objectIndex.Remove(object->Address());
+}
+
+#define GC_HANDLE_PAGE_BITS 12
+#define GC_HANDLE_PAGE_SIZE (1 << GC_HANDLE_PAGE_BITS)
+#define GC_HANDLE_PAGES 65536
+
+// handles name objects by slot, so calls made with one skip the address lookup. A
+// slot's version moves on when its object dies, which is how stale handles are
+// caught; pages never move once made, so resolving a handle takes no lock.
+class GCHandleTable
+{
+private:
+	struct Entry
+	{
+		GCObject* volatile object;
+		volatile uint32_t version;
+		uint32_t nextFree; // 1 + the next free slot, or 0
+	};
+	Entry* volatile pages[GC_HANDLE_PAGES];
+	uint32_t used; // slots ever handed out
+	uint32_t freeSlots; // 1 + the first free slot, or 0
+	GCMutatorLock lock;
+	
+	Entry* EntryFor ( uint32_t slot )
+	{
+		if ((slot >> GC_HANDLE_PAGE_BITS) >= GC_HANDLE_PAGES)
+			return NULL;
+		Entry* page = AtomicLoadPointer(&pages[slot >> GC_HANDLE_PAGE_BITS]);
+		if (!page)
+			return NULL;
+		return &page[slot & (GC_HANDLE_PAGE_SIZE - 1)];
+	}
+	
+	static GC_handle Handle ( uint32_t slot, uint32_t version )
+	{
+		return ((GC_handle)version << 32) | slot;
+	}
+public:
+	GCHandleTable () : used(0), freeSlots(0)
+	{
+		memset((void*)pages, 0, sizeof(pages));
+	}
+	
+	// the object's handle, giving it a slot if it has none yet
+	GC_handle HandleFor ( GCObject* object )
+	{
+		uint32_t slot = object->HandleSlot();
+		if (slot)
+			return Handle(slot - 1, AtomicLoad(&EntryFor(slot - 1)->version));
+		lock.Lock();
+		if (freeSlots)
+		{
+			slot = freeSlots - 1;
+			freeSlots = EntryFor(slot)->nextFree;
+		}
+		else
+		{
+			slot = used;
+			ASSERT((slot >> GC_HANDLE_PAGE_BITS) < GC_HANDLE_PAGES, "out of handles");
+			if (!pages[slot >> GC_HANDLE_PAGE_BITS])
+			{
+				Entry* page = (Entry*)calloc(GC_HANDLE_PAGE_SIZE, sizeof(Entry));
+				ASSERT(page, "could not grow handle table");
+				AtomicStorePointer(&pages[slot >> GC_HANDLE_PAGE_BITS], page);
+			}
+			used++;
+		}
+		Entry* entry = EntryFor(slot);
+		if (!entry->version)
+			AtomicStore(&entry->version, 1u);
+		AtomicStorePointer(&entry->object, object);
+		uint32_t version = entry->version;
+		lock.Unlock();
+		if (!object->ClaimHandle(slot))
+		{
+			// lost the race; the winner's slot is the one to hand out
+			Release(slot);
+			return HandleFor(object);
+		}
+		return Handle(slot, version);
+	}
+	
+	// NULL for a handle whose object has died
+	GCObject* Resolve ( GC_handle handle )
+	{
+		Entry* entry = EntryFor((uint32_t)handle);
+		if (!entry || AtomicLoad(&entry->version) != (uint32_t)(handle >> 32))
+			return NULL;
+		return AtomicLoadPointer(&entry->object);
+	}
+	
+	void Release ( uint32_t slot )
+	{
+		lock.Lock();
+		Entry* entry = EntryFor(slot);
+		AtomicStorePointer(&entry->object, (GCObject*)NULL);
+		// version 0 is never handed out, so a zeroed handle never resolves
+		uint32_t version = entry->version + 1;
+		AtomicStore(&entry->version, version ? version : 1u);
+		entry->nextFree = freeSlots;
+		freeSlots = slot + 1;
+		lock.Unlock();
+	}
+	
+	void Clear ()
+	{
+		for (int i = 0; i < GC_HANDLE_PAGES; i++)
+		{
+			free(pages[i]);
+			pages[i] = NULL;
+		}
+		used = freeSlots = 0;
+	}
+};
+
+GCHandleTable handles;
+
+void ReleaseHandle ( uint32_t slot )
+{
+	handles.Release(slot);
+}
+
+
+static uint64_t MicrosecondsNow ()
+{
+#ifdef WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)(counter.QuadPart * 1000000.0 / frequency.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+// timed phases of collection work, kept in a ring for GC_dump_trace; each is one
+// Chrome trace "complete" event, recorded as the phase ends, so whatever the ring
+// has overwritten never leaves a begin without its end
+class GCTrace
+{
+private:
+	struct Event
+	{
+		const char* name;
+		const char* argName; // or NULL
+		int64_t arg;
+		uint64_t start;
+		uint64_t duration;
+		uint32_t thread;
+	};
+	std::vector<Event> events;
+	size_t next;
+	size_t recorded;
+	volatile uint32_t enabled;
+	volatile uint32_t threadCount;
+	GCSpinLock lock;
+#ifndef SINGLE_THREADED
+	static __thread uint32_t thread;
+#endif
+	
+	uint32_t ThreadID ()
+	{
+#ifndef SINGLE_THREADED
+		if (!thread)
+			thread = AtomicAdd(&threadCount, 1);
+		return thread;
+#else
+		return 1;
+#endif
+	}
+public:
+	GCTrace () : next(0), recorded(0), enabled(0), threadCount(0) {}
+	
+	bool Enabled () { return AtomicLoad(&enabled); }
+	
+	// starts afresh with room for capacity events, or turns tracing off for 0
+	void Reset ( size_t capacity )
+	{
+		lock.Lock();
+		events.assign(capacity, Event());
+		next = recorded = 0;
+		AtomicStore(&enabled, capacity > 0);
+		lock.Unlock();
+	}
+	
+	void Record ( const char* name, uint64_t start, uint64_t end, const char* argName, int64_t arg )
+	{
+		Event event = { name, argName, arg, start, end - start, ThreadID() };
+		lock.Lock();
+		if (!events.empty())
+		{
+			events[next] = event;
+			next = (next + 1) % events.size();
+			recorded++;
+		}
+		lock.Unlock();
+	}
+	
+	bool Write ( FILE* out )
+	{
+		lock.Lock();
+		size_t count = recorded < events.size() ? recorded : events.size();
+		size_t first = recorded < events.size() ? 0 : next;
+		fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		for (size_t i = 0; i < count; i++)
+		{
+			const Event& event = events[(first + i) % events.size()];
+			fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64,
+			        i ? "," : "", event.name, event.thread, event.start, event.duration);
+			if (event.argName)
+				fprintf(out, ",\"args\":{\"%s\":%" PRId64 "}", event.argName, event.arg);
+			fprintf(out, "}");
+		}
+		fprintf(out, "\n]}\n");
+		lock.Unlock();
+		return !ferror(out);
+	}
+};
+
+#ifndef SINGLE_THREADED
+__thread uint32_t GCTrace::thread = 0;
+#endif
+
+GCTrace trace;
+
+// microseconds a cascade of frees has to take to be traced; mutators set one off
+// with every object they drop, and the ring would hold little else
+#define GC_TRACE_CASCADE 10
+
+// times the enclosing block, when tracing is on, if it takes at least the minimum
+class GCTraceScope
+{
+private:
+	const char* name;
+	const char* argName;
+	int64_t arg;
+	uint64_t minimum;
+	uint64_t start;
+public:
+	GCTraceScope ( const char* aName, const char* anArgName = NULL, int64_t anArg = 0, uint64_t aMinimum = 0 )
+	: name(aName), argName(anArgName), arg(anArg), minimum(aMinimum), start(trace.Enabled() ? MicrosecondsNow() : 0) {}
+	
+	~GCTraceScope ()
+	{
+		if (!start)
+			return;
+		uint64_t end = MicrosecondsNow();
+		if (end - start >= minimum)
+			trace.Record(name, start, end, argName, arg);
+	}
+	
+	// for an argument only known once the work is done
+	void SetArg ( int64_t anArg ) { arg = anArg; }
+};
+
+#define GC_MAX_MARK_THREADS 64
+#define GC_PUBLISH_THRESHOLD 64
+
+// marks a field with several threads; each drains a private stack and offers
+// surplus work in a small shared buffer that idle threads steal from
+class GCMarker
+{
+private:
+	struct Worker
+	{
+		GCMarker* marker;
+		std::vector<GCObject*> local;
+		std::vector<GCObject*> shared;
+		volatile uint32_t sharedCount;
+		GCSpinLock lock;
+#ifndef WIN32
+		pthread_t thread;
+#endif
+		char padding[64]; // keep the hot fields of neighbours off each other's cache lines
+	};
+	unsigned threadCount;
+	Worker* workers;
+	volatile uint32_t idleCount;
+	uint32_t epoch;
+	int generation;
+#ifndef WIN32
+	pthread_mutex_t mutex;
+	pthread_cond_t startCondition;
+	pthread_cond_t doneCondition;
+	unsigned phase;
+	unsigned finishedCount;
+	bool exiting;
+	
+	static void* WorkerMain ( void* context )
+	{
+		Worker* worker = (Worker*)context;
+		GCMarker* marker = worker->marker;
+		unsigned seenPhase = 0;
+		pthread_mutex_lock(&marker->mutex);
+		for (;;)
+		{
+			while (marker->phase == seenPhase && !marker->exiting)
+				pthread_cond_wait(&marker->startCondition, &marker->mutex);
+			if (marker->exiting)
+				break;
+			seenPhase = marker->phase;
+			pthread_mutex_unlock(&marker->mutex);
+			marker->Drain(worker);
+			pthread_mutex_lock(&marker->mutex);
+			if (++marker->finishedCount == marker->threadCount - 1)
+				pthread_cond_signal(&marker->doneCondition);
+		}
+		pthread_mutex_unlock(&marker->mutex);
+		return NULL;
+	}
+#endif
+	
+	void Publish ( Worker* worker )
+	{
+		size_t half = worker->local.size() / 2;
+		worker->lock.Lock();
+		// the bottom of the stack tends to hold the biggest unexplored subgraphs
+		worker->shared.insert(worker->shared.end(), worker->local.begin(), worker->local.begin() + half);
+		AtomicStore(&worker->sharedCount, worker->shared.size());
+		worker->lock.Unlock();
+		worker->local.erase(worker->local.begin(), worker->local.begin() + half);
+	}
+	
+	bool StealFrom ( Worker* thief, Worker* victim )
+	{
+		if (!AtomicLoad(&victim->sharedCount))
+			return false;
+		victim->lock.Lock();
+		size_t count = victim->shared.size();
+		size_t take = victim == thief ? count : (count + 1) / 2;
+		thief->local.insert(thief->local.end(), victim->shared.end() - take, victim->shared.end());
+		victim->shared.resize(count - take);
+		AtomicStore(&victim->sharedCount, victim->shared.size());
+		victim->lock.Unlock();
+		return take > 0;
+	}
+	
+	bool Steal ( Worker* worker )
+	{
+		unsigned index = worker - workers;
+		for (unsigned i = 0; i < threadCount; i++)
+		{
+			if (StealFrom(worker, &workers[(index + i) % threadCount]))
+				return true;
+		}
+		return false;
+	}
+	
+	// true once every thread is idle with nothing left to steal
+	bool Terminate ()
+	{
+		AtomicAdd(&idleCount, 1);
+		for (;;)
+		{
+			if (AtomicLoad(&idleCount) == threadCount)
+				return true;
+			for (unsigned i = 0; i < threadCount; i++)
+			{
+				if (AtomicLoad(&workers[i].sharedCount))
+				{
+					AtomicAdd(&idleCount, -1);
+					return false;
+				}
+			}
+			Yield();
+		}
+	}
+	
+	void Drain ( Worker* worker )
+	{
+		std::vector<GCObject*>& local = worker->local;
+		unsigned scanned = 0;
+		for (;;)
+		{
+			while (!local.empty())
+			{
+				GCObject* target = local.back();
+				local.pop_back();
+				for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+				{
+					if (ref->IsWeak())
+						continue;
+					GCObject* liveObject = ref->Target();
+					if (liveObject->Generation() > generation)
+						continue;
+					if (liveObject->MarkShared(epoch))
+						local.push_back(liveObject);
+				}
+				if ((++scanned & 31) == 0 && local.size() > GC_PUBLISH_THRESHOLD && !AtomicLoad(&worker->sharedCount))
+					Publish(worker);
+			}
+			if (!Steal(worker) && Terminate())
+				return;
+		}
+	}
+public:
+	GCMarker () : threadCount(0), workers(NULL) {}
+	
+	unsigned ThreadCount () const { return threadCount; }
+	
+	void Start ( unsigned count )
+	{
+		if (count > GC_MAX_MARK_THREADS)
+			count = GC_MAX_MARK_THREADS;
+#ifdef WIN32
+		count = 1;
+#endif
+		if (count <= 1)
+		{
+			threadCount = 1;
+			return;
+		}
+		threadCount = count;
+		workers = new Worker[count];
+		for (unsigned i = 0; i < count; i++)
+		{
+			workers[i].marker = this;
+			workers[i].sharedCount = 0;
+		}
+#ifndef WIN32
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&startCondition, NULL);
+		pthread_cond_init(&doneCondition, NULL);
+		phase = 0;
+		exiting = false;
+		// the collecting thread doubles as worker 0
+		for (unsigned i = 1; i < count; i++)
+			pthread_create(&workers[i].thread, NULL, WorkerMain, &workers[i]);
+#endif
+	}
+	
+	void Stop ()
+	{
+		if (!workers)
+			return;
+#ifndef WIN32
+		pthread_mutex_lock(&mutex);
+		exiting = true;
+		pthread_cond_broadcast(&startCondition);
+		pthread_mutex_unlock(&mutex);
+		for (unsigned i = 1; i < threadCount; i++)
+			pthread_join(workers[i].thread, NULL);
+		pthread_cond_destroy(&doneCondition);
+		pthread_cond_destroy(&startCondition);
+		pthread_mutex_destroy(&mutex);
+#endif
+		delete [] workers;
+		workers = NULL;
+		threadCount = 0;
+	}
+	
+	// marks everything up to the given generation reachable from the already-marked seeds
+	void Mark ( std::vector<GCObject*>& seeds, uint32_t anEpoch, int aGeneration )
+	{
+		epoch = anEpoch;
+		generation = aGeneration;
+		idleCount = 0;
+		for (size_t i = 0; i < seeds.size(); i++)
+			workers[i % threadCount].local.push_back(seeds[i]);
+		seeds.clear();
+#ifndef WIN32
+		pthread_mutex_lock(&mutex);
+		finishedCount = 0;
+		phase++;
+		pthread_cond_broadcast(&startCondition);
+		pthread_mutex_unlock(&mutex);
+		Drain(&workers[0]);
+		pthread_mutex_lock(&mutex);
+		while (finishedCount < threadCount - 1)
+			pthread_cond_wait(&doneCondition, &mutex);
+		pthread_mutex_unlock(&mutex);
+#endif
+	}
+};
+
+GCMarker marker;
+
+// what collections have done since init, for GC_get_stats; only touched with the
+// write lock held. Depths past GC_STATS_GENERATIONS are counted with the last.
+class GCStatistics
+{
+private:
+	// of the incremental cycle under way
+	uint64_t cycleMark;
+	uint64_t cycleSweep;
+	
+	static size_t Slot ( size_t depth )
+	{
+		return (depth < GC_STATS_GENERATIONS ? depth : GC_STATS_GENERATIONS) - 1;
+	}
+public:
+	uint64_t collections[GC_STATS_GENERATIONS];
+	uint64_t markTime;
+	uint64_t sweepTime;
+	uint64_t lastMark;
+	uint64_t lastSweep;
+	uint64_t pauseTime;
+	uint64_t longestPause;
+	uint64_t promoted;
+	
+	GCStatistics () { Reset(); }
+	
+	void Reset ()
+	{
+		cycleMark = cycleSweep = 0;
+		memset(collections, 0, sizeof(collections));
+		markTime = sweepTime = lastMark = lastSweep = 0;
+		pauseTime = longestPause = promoted = 0;
+	}
+	
+	void Paused ( uint64_t microseconds )
+	{
+		pauseTime += microseconds;
+		if (microseconds > longestPause)
+			longestPause = microseconds;
+	}
+	
+	// a stop-the-world collection of the youngest depth fields
+	void Collected ( size_t depth, uint64_t start, uint64_t marked, uint64_t end )
+	{
+		collections[Slot(depth)]++;
+		lastMark = marked - start;
+		lastSweep = end - marked;
+		markTime += lastMark;
+		sweepTime += lastSweep;
+		Paused(end - start);
+	}
+	
+	// part of an incremental cycle, which is counted as a full collection once it ends
+	void Marked ( uint64_t microseconds )
+	{
+		cycleMark += microseconds;
+		markTime += microseconds;
+	}
+	
+	void Swept ( uint64_t microseconds )
+	{
+		cycleSweep += microseconds;
+		sweepTime += microseconds;
+	}
+	
+	void CycleEnded ( size_t depth )
+	{
+		collections[Slot(depth)]++;
+		lastMark = cycleMark;
+		lastSweep = cycleSweep;
+		cycleMark = cycleSweep = 0;
+	}
+};
+
+GCStatistics statistics;
+
+#define FIELDCOUNT 3
+#define FIELDPARTIALDEPTH 1
+#define GC_MAX_TENURE_AGE 255
+
+// collections an object must survive in a field before it moves up to the next
+unsigned tenureAge = 1;
+// whether survivors leaving the youngest field are copied out of it
+bool compactNursery = false;
+// where they are copied to: chunks of their own, filled in the order they are copied
+GCAllocator::Buffer promotionBuffer(true);
+
+void NoteEdge ( GCObject* owner, GCObject* target );
+
+class GCField
+{
+	friend class GCIncremental;
+private:
+	void Link ( GCObject* object )
+	{
+		object->SetGeneration(generation);
+		object->fieldPrev = NULL;
+		object->fieldNext = objects;
+		if (objects)
+			objects->fieldPrev = object;
+		objects = object;
+		count++;
+		bytes += object->GetLength();
+	}
+	
+	void Unlink ( GCObject* object )
+	{
+		ASSERT(object->Generation() == generation, "unlinking object from the wrong field");
+		if (object->fieldPrev)
+			object->fieldPrev->fieldNext = object->fieldNext;
+		else
+			objects = object->fieldNext;
+		if (object->fieldNext)
+			object->fieldNext->fieldPrev = object->fieldPrev;
+		object->fieldPrev = object->fieldNext = NULL;
+		count--;
+		bytes -= object->GetLength();
+	}
+	
+	// marks anything not yet seen this cycle and queues it for scanning
+	static void Shade ( GCObject* object )
+	{
+		if (object->Mark(markEpoch))
+			markStack.push_back(object);
+	}
+	
+	// the oldest generation holding a strong reference to the object, or -1
+	static int OldestHolder ( GCObject* object )
+	{
+		int oldest = -1;
+		for (GCReference* ref = object->PointingReferences(); ref; ref = ref->NextPointing())
+		{
+			if (!ref->IsWeak() && ref->Owner()->Generation() > oldest)
+				oldest = ref->Owner()->Generation();
+		}
+		return oldest;
+	}
+	
+	// anything held by an object older than the collected fields is a root, and so is
+	// everything it reaches within them; only the remembered sets can hold such
+	// objects, and whatever in them no longer is held from anything older drops out
+	void ShadeRemembered ( int oldestCollected )
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < remembered.size(); i++)
+		{
+			GCObject* target = remembered[i];
+			int holder = OldestHolder(target);
+			if (holder <= generation)
+			{
+				target->SetRememberedSlot(0);
+				continue;
+			}
+			remembered[kept++] = target;
+			target->SetRememberedSlot(kept);
+			if (holder > oldestCollected)
+				Shade(target);
+		}
+		remembered.resize(kept);
+	}
+	
+	// a survivor that has been through enough collections here moves up into the
+	// parent; the oldest field keeps everything. True if it moved.
+	bool Age ( GCObject* object )
+	{
+		if (!parent || object->Survive() < tenureAge)
+			return false;
+		object->ResetAge();
+		// still remembered where it goes, to be checked again when that is collected
+		bool wasRemembered = object->RememberedSlot() != 0;
+		if (wasRemembered)
+			Forget(object);
+		Unlink(object);
+		parent->Link(object);
+		if (wasRemembered && parent->parent)
+			parent->Remember(object);
+		statistics.promoted++;
+		return true;
+	}
+	
+	// threads the unmarked onto the condemned list and ages the rest
+	void Sweep ( GCObject*& condemnedObjects, std::vector<GCObject*>* promoted )
+	{
+		size_t before = count, survived = 0;
+		GCObject* next;
+		for (GCObject* target = objects; target; target = next)
+		{
+			next = target->fieldNext;
+			if (!target->IsMarked(markEpoch))
+			{
+				// unreferenced
+				ASSERT(target != rootObject, "root object ended up unreferenced?");
+				target->SetCondemned();
+				Unlink(target);
+				UnindexObject(target);
+				target->fieldNext = condemnedObjects;
+				condemnedObjects = target;
+			}
+			else
+			{
+				survived++;
+				if (!Age(target))
+					continue;
+				if (promoted)
+					promoted->push_back(target);
+				if (compactNursery && !generation && target->Movable())
+				{
+					target->SetEvacuating(true);
+					evacuees.push_back(target);
+				}
+			}
+		}
+		// whatever was here at the last sweep has been judged once already; what has
+		// arrived since, born or promoted, is where the garbage tends to be
+		size_t arrived = before > settled ? before - settled : 0, died = before - survived;
+		if (arrived || died)
+			mortality = (mortality + (died >= arrived ? 1.0 : (double)died / arrived)) / 2;
+		settled = count;
+	}
+	
+	// copies an evacuee and, depth first along strong references, every evacuee it
+	// leads to, so that what is traced together sits together
+	static void EvacuateFrom ( GCObject* object )
+	{
+		markStack.push_back(object);
+		while (!markStack.empty())
+		{
+			GCObject* target = markStack.back();
+			markStack.pop_back();
+			if (!target->Evacuating())
+				continue;
+			target->SetEvacuating(false);
+			GCChunk* newChunk;
+			size_t len = target->GetLength();
+			void* newAddress = allocator.Allocate(len, &newChunk, promotionBuffer);
+			memcpy(newAddress, target->Address(), len);
+			target->Migrate(newAddress, newChunk);
+			for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+			{
+				if (!ref->IsWeak() && ref->Target()->Evacuating())
+					markStack.push_back(ref->Target());
+			}
+		}
+	}
+	
+	// copies what left the youngest field into the promotion buffer, starting from
+	// whatever is held from outside it; every registered pointer to a copy is
+	// brought up to date
+	static void Evacuate ()
+	{
+		for (size_t i = 0; i < evacuees.size(); i++)
+		{
+			GCObject* target = evacuees[i];
+			if (!target->Evacuating())
+				continue;
+			for (GCReference* ref = target->PointingReferences(); ref; ref = ref->NextPointing())
+			{
+				if (!ref->IsWeak() && !ref->Owner()->Evacuating())
+				{
+					EvacuateFrom(target);
+					break;
+				}
+			}
+		}
+		// whatever that missed, in the order it was swept
+		for (size_t i = 0; i < evacuees.size(); i++)
+			EvacuateFrom(evacuees[i]);
+		evacuees.clear();
+	}
+	
+	static uint32_t markEpoch;
+	static std::vector<GCObject*> markStack;
+	static std::vector<GCField*> collecting;
+	static std::vector<GCObject*> promoted;
+	static std::vector<GCObject*> evacuees;
+	GCObject* objects;
+	GCField* parent;
+	int generation;
+	// objects here that something in an older field may hold a strong reference to
+	std::vector<GCObject*> remembered;
+	size_t count;
+	// payload of what is here; signed, as a resize may land before a thread's nursery is adopted
+	int64_t bytes;
+	size_t settled; // objects left here by the last sweep
+	double mortality; // running average of the share of arrivals a sweep finds dead
+public:
+	GCField ( GCField* aParent, int aGeneration ) : objects(NULL), parent(aParent), generation(aGeneration), count(0), bytes(0), settled(0), mortality(0.5) {}
+	
+	GCField* Parent () const { return parent; }
+	GCObject* Objects () const { return objects; }
+	size_t Count () const { return count; }
+	int64_t Bytes () const { return bytes; }
+	// what collecting here would free, going by how arrivals have fared before
+	double ExpectedGarbage () const { return count > settled ? (count - settled) * mortality : 0.0; }
+	~GCField ()
+	{
+		while (objects)
+		{
+			GCObject* object = objects;
+			Unlink(object);
+			delete object;
+		}
+		if (parent) delete parent;
+	}
+	// collects this field and the depth - 1 above it in one pass
+	void Collect ( int depth )
+	{
+		GCTraceScope scope("collect", "generations");
+		uint64_t start = MicrosecondsNow();
+		for (GCField* f = this; f && depth-- > 0; f = f->parent)
+			collecting.push_back(f);
+		scope.SetArg(collecting.size());
+		int oldest = collecting.back()->generation;
+		if (++markEpoch == 0)
+			++markEpoch; // fresh objects carry epoch 0
+		markStack.clear();
+		// root object is the first one to talk to
+		Shade(rootObject);
+		for (size_t i = 0; i < collecting.size(); i++)
+		{
+			if (collecting[i]->parent)
+				collecting[i]->ShadeRemembered(oldest);
+		}
+		// work through list of all referenced objects
+		if (marker.ThreadCount() > 1)
+			marker.Mark(markStack, markEpoch, oldest);
+		while (!markStack.empty())
+		{
+			GCObject* target = markStack.back();
+			ASSERT(target, "null target in Collect");
+			markStack.pop_back();
+			// look through all refs owned by this object
+			for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+			{
+				// this discards weak references
+				if (ref->IsWeak())
+				{
+					continue;
+				}
+				// get the target of this
+				GCObject* liveObject = ref->Target();
+				ASSERT(liveObject, "found null target");
+				// grab only targets in the collected fields
+				if (liveObject->Generation() > oldest)
+				{
+					continue;
+				}
+				Shade(liveObject);
+			}
+		}
+		uint64_t marked = MicrosecondsNow();
+		size_t collected = collecting.size();
+		if (trace.Enabled())
+			trace.Record("mark", start, marked, "generations", collected);
+		// a promoted object can end up older than what it holds when survivors stay
+		// behind or several fields move up at once, which the remembered sets must hear of
+		std::vector<GCObject*>* moved = collecting.size() > 1 || tenureAge > 1 ? &promoted : NULL;
+		// sweep oldest first, so survivors moving up land in fields already swept
+		GCObject* condemnedObjects = NULL;
+		disableTrivialExecution = true;
+		for (size_t i = collecting.size(); i-- > 0;)
+		{
+			GCTraceScope sweepScope("sweep", "generation", collecting[i]->generation);
+			collecting[i]->Sweep(condemnedObjects, moved);
+		}
+		collecting.clear();
+		// everything dead is flagged before anything is freed, so edges between
+		// condemned objects are just unlinked rather than cascading
+		{
+			GCTraceScope freeScope("free", "objects");
+			size_t freed = 0;
+			for (; condemnedObjects; freed++)
+			{
+				GCObject* target = condemnedObjects;
+				condemnedObjects = target->fieldNext;
+				delete target;
+			}
+			freeScope.SetArg(freed);
+		}
+		disableTrivialExecution = false;
+		// after the dead are gone, so the copies can reuse the space they held
+		if (!evacuees.empty())
+		{
+			GCTraceScope evacuateScope("evacuate", "objects", evacuees.size());
+			Evacuate();
+		}
+		for (size_t i = 0; i < promoted.size(); i++)
+		{
+			for (GCReference* ref = promoted[i]->OwnedReferences(); ref; ref = ref->NextOwned())
+			{
+				if (!ref->IsWeak())
+					NoteEdge(promoted[i], ref->Target());
+			}
+		}
+		promoted.clear();
+		statistics.Collected(collected, start, marked, MicrosecondsNow());
+	}
+	void InsertShallow ( GCObject* object )
+	{
+#ifndef SINGLE_THREADED
+		if (!globalLock.HeldExclusively())
+		{
+			// the thread keeps it on a list of its own until the next safepoint
+			GCThread* thread = CurrentThread();
+			object->SetGeneration(generation);
+			object->fieldPrev = NULL;
+			object->fieldNext = thread->nurseryHead;
+			if (thread->nurseryHead)
+				thread->nurseryHead->fieldPrev = object;
+			else
+				thread->nurseryTail = object;
+			thread->nurseryHead = object;
+			thread->nurseryCount++;
+			thread->nurseryBytes += object->GetLength();
+			IndexObject(object);
+			return;
+		}
+#endif
+		Link(object);
+		IndexObject(object);
+	}
+	// splices in a run of objects already stamped with this field's generation
+	void Adopt ( GCObject* head, GCObject* tail, size_t aCount, size_t someBytes )
+	{
+		tail->fieldNext = objects;
+		if (objects)
+			objects->fieldPrev = tail;
+		objects = head;
+		count += aCount;
+		bytes += someBytes;
+	}
+	// the generation's share of a resize; needs the write lock
+	void Resized ( int aGeneration, int64_t someBytes )
+	{
+		if (aGeneration != generation)
+		{
+			if (parent)
+				parent->Resized(aGeneration, someBytes);
+			return;
+		}
+		bytes += someBytes;
+	}
+	// files an object under its generation's remembered set; needs the write lock
+	void Remember ( GCObject* object )
+	{
+		if (object->Generation() != generation)
+		{
+			parent->Remember(object);
+			return;
+		}
+		remembered.push_back(object);
+		object->SetRememberedSlot(remembered.size());
+	}
+	void Forget ( GCObject* object )
+	{
+		if (object->Generation() != generation)
+		{
+			parent->Forget(object);
+			return;
+		}
+		uint32_t slot = object->RememberedSlot();
+		ASSERT(slot && slot != GC_REMEMBER_PENDING, "forgetting an object not in a remembered set");
+		GCObject* last = remembered.back();
+		remembered[slot - 1] = last;
+		last->SetRememberedSlot(slot);
+		remembered.pop_back();
+		object->SetRememberedSlot(0);
+	}
+	void InsertDeep ( GCObject* object )
+	{
+		if (parent)
+			parent->InsertDeep(object);
 		else
+			InsertShallow(object);
+	}
+	GCObject* Lookup ( void* ptr )
+	{
+		return FindObject(ptr);
+	}
+	void Remove ( GCObject* obj )
+	{
+		ASSERT(!disableTrivialExecution, "Remove() called with TE disabled");
+		if (obj->Generation() == generation)
+		{
+			Unlink(obj);
+			UnindexObject(obj);
+		}
+		else if (parent)
+			parent->Remove(obj);
+	}
+};
+
+uint32_t GCField::markEpoch = 0;
+std::vector<GCObject*> GCField::markStack;
+std::vector<GCField*> GCField::collecting;
+std::vector<GCObject*> GCField::promoted;
+std::vector<GCObject*> GCField::evacuees;
+
+GCField* field;
+int fieldCount = FIELDCOUNT;
+
+void AccountResized ( int generation, int64_t bytes )
+{
+	if (generation >= 0)
+		field->Resized(generation, bytes);
+}
+
+// called for a new strong edge: one from an older generation into a younger one
+// gets its target remembered, so partial collections find it without searching.
+// The root is scanned by every collection anyway and is left out.
+void NoteEdge ( GCObject* owner, GCObject* target )
+{
+	if (owner == rootObject || owner->Generation() <= target->Generation())
+		return;
+	if (target->RememberedSlot() || !target->ClaimRemembered())
+		return;
+#ifndef SINGLE_THREADED
+	if (!globalLock.HeldExclusively())
+	{
+		CurrentThread()->remembered.push_back(target);
+		return;
+	}
+#endif
+	field->Remember(target);
+}
+
+void ForgetRemembered ( GCObject* object )
+{
+#ifndef SINGLE_THREADED
+	if (object->RememberedSlot() == GC_REMEMBER_PENDING)
+	{
+		for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+		{
+			std::vector<GCObject*>& remembered = thread->remembered;
+			for (size_t i = 0; i < remembered.size(); i++)
+			{
+				if (remembered[i] == object)
+					remembered[i] = NULL;
+			}
+		}
+		object->SetRememberedSlot(0);
+		return;
+	}
+#endif
+	field->Forget(object);
+}
+
+#define GC_RECLAIM_BATCH 32
+
+// objects condemned one at a time, waiting to be freed; each batch off the end
+// has its finalisers run together, while every payload in it is still intact,
+// and then is unlinked and freed, which condemns what only it held onto the end
+// for the next. Releasing the head of a long chain loops here rather than
+// recursing once per node, and batches stay small so the cascade under one
+// object is dealt with while it is still in cache
+std::vector<GCObject*> reclaiming;
+bool reclaimActive = false;
+
+static void Reclaim ()
+{
+	GCTraceScope scope("condemn", "objects", 0, GC_TRACE_CASCADE);
+	size_t reclaimed = 0;
+	reclaimActive = true;
+	while (!reclaiming.empty())
+	{
+		size_t end = reclaiming.size();
+		size_t begin = end > GC_RECLAIM_BATCH ? end - GC_RECLAIM_BATCH : 0;
+		size_t i;
+		// indexed throughout: finalisers and unlinking may grow the list under us
+		uint64_t finaliseStart = trace.Enabled() ? MicrosecondsNow() : 0;
+		size_t called = 0;
+		for (i = begin; i < end; i++)
+			called += reclaiming[i]->Finalise();
+		if (finaliseStart && called)
+			trace.Record("finalise", finaliseStart, MicrosecondsNow(), "objects", called);
+		for (i = begin; i < end; i++)
+			delete reclaiming[i];
+		reclaiming.erase(reclaiming.begin() + begin, reclaiming.begin() + end);
+		reclaimed += end - begin;
+	}
+	reclaimActive = false;
+	scope.SetArg(reclaimed);
+}
+
+void GCObject::Condemn ()
+{
+	if (condemned)
+		return;
+	condemned = true;
+	field->Remove(this);
+	reclaiming.push_back(this);
+	if (!reclaimActive)
+		Reclaim();
+}
+
+#define GC_STEP_SLICE 64
+#define GC_GREY_BATCH 256
+
+static void TargetUnreferenced ( GCObject* target );
+
+// a full collection carried out a slice at a time. While one is under way, new
+// objects are born marked, strong edges shade their targets both when they are
+// made and when they are removed, and objects left unreferenced wait for the
+// cycle to end instead of dying on the spot, so nothing on the grey stack or
+// ahead of the sweep is freed under it. Removal shading keeps everything that
+// was reachable when the cycle began, which is what lets the background
+// collector mark while mutators run.
+class GCIncremental
+{
+private:
+	enum Phase
+	{
+		IDLE,
+		MARKING,
+		SWEEPING
+	};
+	Phase phase;
+	std::vector<GCObject*> grey;
+	std::vector<GCObject*> deferred;
+	// swept oldest first, so survivors moved up are not visited twice
+	std::vector<GCField*> sweepFields;
+	size_t sweepIndex;
+	GCObject* sweepCursor;
+	GCObject* dead;
+#ifndef SINGLE_THREADED
+	// full batches of thread grey lists, for the background collector to take mid-cycle
+	std::vector<GCObject*> handoff;
+	GCSpinLock handoffLock;
+#endif
+	
+	void Begin ()
+	{
+		if (++GCField::markEpoch == 0)
+			++GCField::markEpoch;
+		sweepFields.clear();
+		for (GCField* f = field; f; f = f->parent)
+			sweepFields.insert(sweepFields.begin(), f);
+		phase = MARKING;
+		Shade(rootObject);
+	}
+	
+	void CollectThreadGrey ()
+	{
+#ifndef SINGLE_THREADED
+		for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+		{
+			grey.insert(grey.end(), thread->grey.begin(), thread->grey.end());
+			thread->grey.clear();
+		}
+		grey.insert(grey.end(), handoff.begin(), handoff.end());
+		handoff.clear();
+#endif
+	}
+	
+	void MarkOne ()
+	{
+		if (grey.empty())
+		{
+			CollectThreadGrey();
+			if (grey.empty())
+			{
+				EndMarking();
+				return;
+			}
+		}
+		GCObject* target = grey.back();
+		grey.pop_back();
+		for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+		{
+			if (ref->IsWeak())
+				continue;
+			if (ref->Target()->Mark(GCField::markEpoch))
+				grey.push_back(ref->Target());
+		}
+	}
+	
+	void EndMarking ()
+	{
+		// the unmarked are garbage the sweep is about to free; only survivors stay deferred
+		size_t kept = 0;
+		for (size_t i = 0; i < deferred.size(); i++)
+		{
+			if (deferred[i]->IsMarked(GCField::markEpoch))
+				deferred[kept++] = deferred[i];
+			else
+				deferred[i]->ClearRelease();
+		}
+		deferred.resize(kept);
+		sweepIndex = 0;
+		sweepCursor = sweepFields[0]->objects;
+		phase = SWEEPING;
+	}
+	
+	void SweepOne ()
+	{
+		while (!sweepCursor)
+		{
+			if (++sweepIndex == sweepFields.size())
+			{
+				phase = IDLE;
+				return;
+			}
+			sweepCursor = sweepFields[sweepIndex]->objects;
+		}
+		GCField* sweepField = sweepFields[sweepIndex];
+		GCObject* target = sweepCursor;
+		sweepCursor = target->fieldNext;
+		if (!target->IsMarked(GCField::markEpoch))
+		{
+			ASSERT(target != rootObject, "root object ended up unreferenced?");
+			target->SetCondemned();
+			sweepField->Unlink(target);
+			UnindexObject(target);
+			target->fieldNext = dead;
+			dead = target;
+		}
+		else if (sweepField->Age(target))
+		{
+			// it moved up a field, which was swept before this one; things born since
+			// the sweep passed, or left behind here, may be younger than it now is
+			for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+			{
+				if (!ref->IsWeak())
+					NoteEdge(target, ref->Target());
+			}
+		}
+	}
+	
+	// as in a full collection, the dead are flagged before any of them is freed
+	void FreeDead ()
+	{
+		disableTrivialExecution = true;
+		while (dead)
+		{
+			GCObject* target = dead;
+			dead = target->fieldNext;
+			delete target;
+		}
+		disableTrivialExecution = false;
+	}
+	
+	void EndCycle ()
+	{
+		// condemning one may cascade into others further down, which get nulled out
+		size_t count = deferred.size();
+		for (size_t i = 0; i < count; i++)
+		{
+			GCObject* object = deferred[i];
+			if (!object)
+				continue;
+			deferred[i] = NULL;
+			object->ClearRelease();
+			TargetUnreferenced(object);
+		}
+		deferred.erase(deferred.begin(), deferred.begin() + count);
+	}
+public:
+	GCIncremental () : phase(IDLE), sweepIndex(0), sweepCursor(NULL), dead(NULL) {}
+	
+	bool Active () const { return phase != IDLE; }
+	bool Sweeping () const { return phase == SWEEPING; }
+	uint32_t Epoch () const { return GCField::markEpoch; }
+	
+	// joins the cycle under way or begins one; returns its epoch
+	uint32_t Start ()
+	{
+		if (phase == IDLE)
+			Begin();
+		return GCField::markEpoch;
+	}
+	
+	// the write barrier and the colour of new objects; from mutator threads, the
+	// object goes on the thread's own grey list until the next step collects it
+	void Shade ( GCObject* object )
+	{
+		if (phase != MARKING || !object->MarkShared(GCField::markEpoch))
+			return;
+#ifndef SINGLE_THREADED
+		if (!globalLock.HeldExclusively())
+		{
+			std::vector<GCObject*>& local = CurrentThread()->grey;
+			local.push_back(object);
+			if (local.size() >= GC_GREY_BATCH)
+			{
+				handoffLock.Lock();
+				handoff.insert(handoff.end(), local.begin(), local.end());
+				handoffLock.Unlock();
+				local.clear();
+			}
+			return;
+		}
+#endif
+		grey.push_back(object);
+	}
+	
+#ifndef SINGLE_THREADED
+	// the background collector's marking, done inside a read section while
+	// mutators run; each object is scanned under its edge stripe. False once
+	// the cycle begun at the given epoch is out of grey objects this thread
+	// can see, or is no longer marking; the rest is left to the remark.
+	bool MarkConcurrently ( uint32_t epoch, unsigned count )
+	{
+		if (phase != MARKING || GCField::markEpoch != epoch)
+			return false;
+		for (unsigned i = 0; i < count; i++)
+		{
+			if (grey.empty())
+			{
+				handoffLock.Lock();
+				grey.swap(handoff);
+				handoffLock.Unlock();
+				if (grey.empty())
+					return false;
+			}
+			GCObject* target = grey.back();
+			grey.pop_back();
+			edgeLocks.Lock(target, target);
+			for (GCReference* ref = target->OwnedReferences(); ref; ref = ref->NextOwned())
+			{
+				if (ref->IsWeak())
+					continue;
+				if (ref->Target()->MarkShared(epoch))
+					grey.push_back(ref->Target());
+			}
+			edgeLocks.Unlock(target, target);
+		}
+		return true;
+	}
+#endif
+	
+	void BornDuringCycle ( GCObject* object )
+	{
+		if (phase != IDLE)
+			object->Mark(GCField::markEpoch);
+	}
+	
+	// holds an unreferenced object back until the cycle is done with it
+	void Defer ( GCObject* object )
+	{
+		if (phase == SWEEPING && !object->IsMarked(GCField::markEpoch))
+			return; // the sweep frees it
+		if (object->QueueRelease())
+			deferred.push_back(object);
+	}
+	
+	void Forget ( GCObject* object )
+	{
+		for (size_t i = 0; i < deferred.size(); i++)
+		{
+			if (deferred[i] == object)
+				deferred[i] = NULL;
+		}
+	}
+	
+	// does about a budget's worth of microseconds of work; true once the cycle is over
+	bool Step ( uint64_t budget )
+	{
+		GCTraceScope scope("incremental step", "budget", budget);
+		uint64_t start = MicrosecondsNow(), now = start;
+		if (phase == IDLE)
+			Begin();
+		uint64_t deadline = start + budget;
+		do
+		{
+			// a slice is put down to whichever phase it began in
+			bool marking = phase == MARKING;
+			for (unsigned i = 0; i < GC_STEP_SLICE && phase != IDLE; i++)
+			{
+				if (phase == MARKING)
+					MarkOne();
+				else
+					SweepOne();
+			}
+			uint64_t sliceStart = now;
+			now = MicrosecondsNow();
+			if (marking)
+				statistics.Marked(now - sliceStart);
+			else
+				statistics.Swept(now - sliceStart);
+		} while (phase != IDLE && now < deadline);
+		FreeDead();
+		bool finished = phase == IDLE;
+		if (finished)
+		{
+			EndCycle();
+			triggers.Collected(true);
+		}
+		uint64_t end = MicrosecondsNow();
+		statistics.Swept(end - now);
+		statistics.Paused(end - start);
+		if (finished)
+			statistics.CycleEnded(fieldCount);
+		return finished;
+	}
+	
+	void Finish ()
+	{
+		while (phase != IDLE)
+			Step((uint64_t)-1 / 2);
+	}
+	
+	// for shutdown, when everything goes anyway
+	void Abandon ()
+	{
+		for (size_t i = 0; i < deferred.size(); i++)
+		{
+			if (deferred[i])
+				deferred[i]->ClearRelease();
+		}
+		deferred.clear();
+		grey.clear();
+#ifndef SINGLE_THREADED
+		for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+			thread->grey.clear();
+		handoff.clear();
+#endif
+		phase = IDLE;
+	}
+};
+
+GCIncremental incremental;
+
+GCReference::GCReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation, unsigned someFlags )
+: owner(anOwner),
+  target(aTarget),
+  pointerLocation(aPointerLocation),
+  flags(someFlags),
+  ownedPrev(NULL),
+  ownedNext(NULL),
+  pointingPrev(NULL),
+  pointingNext(NULL)
+{
+	ASSERT(anOwner, "reference constructed with null owner");
+	ASSERT(aTarget, "reference constructed with null target");
+	DEBUG(printf("[GC] +%s %p => %p (%p)\n", IsWeak() ? "WR" : "SR", anOwner->Address(), aTarget->Address(), aPointerLocation));
+	GCCounters& tally = Counters();
+	if (IsWeak())
+		tally.weakReferences++;
+	else
+		tally.strongReferences++;
+}
+
+GCReference::~GCReference ()
+{
+	DEBUG(printf("[GC] -%s %p => %p (%p)\n", IsWeak() ? "WR" : "SR", owner->Address(), target->Address(), pointerLocation));
+	GCCounters& tally = Counters();
+	if (IsWeak())
+		tally.weakReferences--;
+	else
+		tally.strongReferences--;
+}
+
+void* GCReference::operator new ( size_t size )
+{
+	ASSERT(size == sizeof(GCReference), "GCReference allocated with odd size");
+	(void)size;
+#ifdef SINGLE_THREADED
+	return referencePool.Allocate();
+#else
+	return CurrentThread()->referenceCells.Allocate(referencePool);
+#endif
+}
+
+void GCReference::operator delete ( void* ptr )
+{
+#ifdef SINGLE_THREADED
+	referencePool.Free(ptr);
+#else
+	CurrentThread()->referenceCells.Free(referencePool, ptr);
+#endif
+}
+
+#define GC_AUTO_MIN_GARBAGE 1024
+
+// running average of the microseconds a collection spends per object in the fields it covers
+double costPerObject = 0.0;
+
+size_t CountObjects ( int depth )
+{
+	size_t objects = 0;
+	for (GCField* f = field; f && depth-- > 0; f = f->Parent())
+		objects += f->Count();
+	return objects;
+}
+
+// collects the youngest depth fields, keeping the cost estimate up to date
+void CollectFields ( int depth )
+{
+	size_t objects = CountObjects(depth);
+	uint64_t start = MicrosecondsNow();
+	field->Collect(depth);
+	if (objects)
+	{
+		double cost = (double)(MicrosecondsNow() - start) / objects;
+		costPerObject = costPerObject > 0.0 ? (costPerObject + cost) / 2 : cost;
+	}
+	triggers.Collected(depth >= fieldCount);
+}
+
+void CollectPartial ()
+{
+	CollectFields(FIELDPARTIALDEPTH);
+}
+
+void CollectFull ()
+{
+	CollectFields(fieldCount);
+}
+
+// how deep an adaptive collection goes: an older field is taken in, along with
+// everything younger, while it is expected to give up at least as much garbage for
+// each object it adds to the trace as the fields already chosen do, so a deeper
+// pause always pays for itself in memory. A large settled field holding a little
+// new garbage is left to full collections
+int ChooseDepth ( double& garbage )
+{
+	int depth = FIELDPARTIALDEPTH;
+	size_t objects = 0;
+	garbage = 0.0;
+	GCField* f = field;
+	for (int i = 0; i < depth; i++, f = f->Parent())
+	{
+		garbage += f->ExpectedGarbage();
+		objects += f->Count();
+	}
+	for (; f; f = f->Parent())
+	{
+		double more = f->ExpectedGarbage();
+		// more / f->Count() against garbage / objects, without dividing by nothing
+		if (more < GC_AUTO_MIN_GARBAGE || more * objects < garbage * f->Count())
+			break;
+		garbage += more;
+		objects += f->Count();
+		depth++;
+	}
+	return depth;
+}
+
+GCObject* GetObject ( void* ptr )
+{
+	if (!ptr)
+		return NULL;
+	GCObject* object = field->Lookup(ptr);
+	//ASSERT(object, "GetObject returned 0");
+	return object;
+}
+
+#define GC_LOOKUP_CACHE 4
+#define GC_BATCH_SLICE 4096
+
+// the last few objects a batch looked up; batches tend to name the same owner over and over
+class GCLookupCache
+{
+private:
+	void* addresses[GC_LOOKUP_CACHE];
+	GCObject* objects[GC_LOOKUP_CACHE];
+	unsigned next;
+public:
+	GCLookupCache () : next(0)
+	{
+		memset(addresses, 0, sizeof(addresses));
+	}
+	
+	GCObject* Get ( void* address )
+	{
+		for (unsigned i = 0; i < GC_LOOKUP_CACHE; i++)
 		{
-			GCObject* object = iter->second;
-			field.erase(iter);
-			field.insert(std::make_pair(newAddress, object));
+			if (addresses[i] == address && address)
+				return objects[i];
 		}
+		GCObject* object = GetObject(address);
+		addresses[next] = address;
+		objects[next] = object;
+		next = (next + 1) % GC_LOOKUP_CACHE;
+		return object;
 	}
 };
 
-GCField* field;
+// objects a batch of unregistrations left unreferenced, held back until it ends so
+// that nothing it has looked up dies under it; only ever touched by a thread that
+// would otherwise free them on the spot, which no other thread is running beside
+std::vector<GCObject*> batchReleased;
+bool batching = false;
 
-void GCObject::Condemn ( GCReference* lastReference )
+// called once a reference has left the target's pointing list
+static void TargetUnreferenced ( GCObject* target )
 {
-	if (condemned || (lastReference && disableTrivialExecution))
+	if (target->IsCondemned() || disableTrivialExecution)
 		return;
-	condemned = true;
-	if (lastReference)
+#ifndef SINGLE_THREADED
+	if (!globalLock.HeldExclusively())
 	{
-		std::set<GCReference*>::iterator iter = pointingReferences.find(lastReference);
-		ASSERT(iter != pointingReferences.end(), "lastReference not pointing");
-		pointingReferences.erase(iter);
+		// another thread may be handing out a new reference to it right now,
+		// so the verdict waits until nothing else is running
+		if (target->QueueRelease())
+			CurrentThread()->released.push_back(target);
+		return;
 	}
-	else
+#endif
+	if (batching)
+	{
+		if (target->QueueRelease())
+			batchReleased.push_back(target);
+		return;
+	}
+	if (incremental.Active())
+	{
+		incremental.Defer(target);
+		return;
+	}
+	if (!target->IsReferenced())
+	{
+		DEBUG(printf("[GC] -OBJ %p (completely unreferenced)\n", target->Address()));
+		target->Condemn();
+	}
+}
+
+// a queued object died some other way; its entry must not be revisited
+void ForgetReleased ( GCObject* object )
+{
+#ifndef SINGLE_THREADED
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
 	{
-		std::vector<GCReference*> worklist;
-		std::set<GCReference*>::iterator iter;
-		for (iter = pointingReferences.begin(); iter != pointingReferences.end(); ++iter)
+		std::vector<GCObject*>& released = thread->released;
+		for (size_t i = 0; i < released.size(); i++)
 		{
-			if (!(*iter)->IsWeak())
-			{
-				worklist.push_back(*iter);
-			}
+			if (released[i] == object)
+				released[i] = NULL;
 		}
-		for (std::vector<GCReference*>::iterator wlIter = worklist.begin(); wlIter != worklist.end(); ++wlIter)
-		{
-			iter = pointingReferences.find(*wlIter);
-			ASSERT(iter != pointingReferences.end(), "worklist item not in reference list");
-			pointingReferences.erase(iter);
-		} 
 	}
-	field->Remove(this);
-	delete this;
+#endif
+	for (size_t i = 0; i < batchReleased.size(); i++)
+	{
+		if (batchReleased[i] == object)
+			batchReleased[i] = NULL;
+	}
+	incremental.Forget(object);
+	object->ClearRelease();
 }
 
-#define FIELDCOUNT 3
-#define FIELDPARTIALDEPTH 1
-
-GCLock globalLock;
+// starts holding back what a batch leaves unreferenced, if it would otherwise die
+// straight away; true if this batch is the one to settle it
+bool BeginBatch ()
+{
+	if (batching || !globalLock.HeldExclusively())
+		return false;
+	batching = true;
+	return true;
+}
 
-GCWeakReference::GCWeakReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation )
-: GCReference(anOwner, aTarget, aPointerLocation)
+// lets go of what the batch held back; a finaliser may start a batch of its own,
+// which settles whatever is left here along with its own
+void SettleBatch ()
 {
-	DEBUG(printf("[GC] +WR %p => %p (%p)\n", anOwner->Address(), aTarget->Address(), aPointerLocation));
+	batching = false;
+	while (!batchReleased.empty())
+	{
+		GCObject* object = batchReleased.back();
+		batchReleased.pop_back();
+		if (!object)
+			continue;
+		object->ClearRelease();
+		TargetUnreferenced(object);
+	}
 }
 
-GCWeakReference::~GCWeakReference ()
+// moves every thread's new objects into the shared nursery, and files what they
+// remembered and accounts what they allocated; needs the write lock
+void AdoptNurseries ()
 {
-	DEBUG(printf("[GC] -WR %p => %p (%p)\n", owner->Address(), target->Address(), pointerLocation));
+#ifndef SINGLE_THREADED
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+	{
+		GCReference* ref = thread->pendingEdges;
+		thread->pendingEdges = NULL;
+		while (ref)
+		{
+			GCReference* next = ref->ownedNext;
+			if (ref->IsDropped())
+			{
+				delete ref;
+			}
+			else
+			{
+				ref->SetPending(false);
+				ref->Target()->SetPendingEdge(false);
+				ref->Owner()->AddOwnedReference(ref);
+			}
+			ref = next;
+		}
+		for (size_t i = 0; i < thread->remembered.size(); i++)
+		{
+			if (thread->remembered[i])
+				field->Remember(thread->remembered[i]);
+		}
+		thread->remembered.clear();
+		triggers.Flush(thread->pendingBytes, thread->pendingObjects);
+		if (!thread->nurseryHead)
+			continue;
+		field->Adopt(thread->nurseryHead, thread->nurseryTail, thread->nurseryCount, thread->nurseryBytes);
+		thread->nurseryHead = thread->nurseryTail = NULL;
+		thread->nurseryCount = thread->nurseryBytes = 0;
+	}
+#endif
 }
 
-GCStrongReference::GCStrongReference ( GCObject* anOwner, GCObject* aTarget, void** aPointerLocation )
-: GCReference(anOwner, aTarget, aPointerLocation)
+// settles every object mutators queued as possibly unreferenced; needs the write
+// lock, and adopts the nurseries first since condemning unlinks from the field
+void ReleaseQueued ()
 {
-	DEBUG(printf("[GC] +SR %p => %p (%p)\n", anOwner->Address(), aTarget->Address(), aPointerLocation));
+#ifndef SINGLE_THREADED
+	GCTraceScope scope("release", NULL, 0, GC_TRACE_CASCADE);
+	AdoptNurseries();
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+	{
+		std::vector<GCObject*>& released = thread->released;
+		// condemning one may cascade into others further down, which get nulled out
+		for (size_t i = 0; i < released.size(); i++)
+		{
+			GCObject* object = released[i];
+			if (!object)
+				continue;
+			released[i] = NULL;
+			object->ClearRelease();
+			TargetUnreferenced(object);
+		}
+		released.clear();
+	}
+#endif
 }
 
-GCStrongReference::~GCStrongReference ()
+// ends a read section that may have queued objects, settling them once enough have built up
+void ReadUnlockReleasing ()
 {
-	DEBUG(printf("[GC] -SR %p => %p\n", owner->Address(), target->Address()));
+#ifndef SINGLE_THREADED
+	bool flush = CurrentThread()->released.size() >= GC_RELEASE_BATCH;
+	globalLock.ReadUnlock();
+	if (flush)
+	{
+		globalLock.WriteLock();
+		ReleaseQueued();
+		globalLock.WriteUnlock();
+	}
+#else
+	globalLock.ReadUnlock();
+#endif
 }
 
-void CollectPartial ()
+// runs the collection allocation has made due; not from inside a finaliser,
+// which would have a collection start in the middle of another
+void CollectDue ()
 {
-	field->Collect(FIELDPARTIALDEPTH);
+	globalLock.WriteLock();
+	if (!finaliserDepth)
+	{
+		GCTriggers::Collection due = triggers.TakeDue();
+		if (due != GCTriggers::NONE)
+		{
+			GCTraceScope scope("triggered collection", "partial", due == GCTriggers::PARTIAL);
+			ReleaseQueued();
+			incremental.Finish();
+			DEBUG(printf("[GC] doing automatic %s collection\n", due == GCTriggers::FULL ? "full" : "generational"));
+			(due == GCTriggers::FULL ? CollectFull : CollectPartial)();
+		}
+	}
+	globalLock.WriteUnlock();
 }
 
-void CollectFull ()
+// publishes a new reference on both of its ends
+void LinkReference ( GCReference* reference )
 {
-	field->Collect(FIELDCOUNT);
+	GCObject* src = reference->Owner();
+	GCObject* dst = reference->Target();
+	edgeLocks.Lock(src, dst);
+	src->AddOwnedReference(reference);
+	dst->AddPointingReference(reference);
+	edgeLocks.Unlock(src, dst);
 }
 
-GCObject* GetObject ( void* ptr )
+// as LinkReference, for a target no other thread can see yet
+void LinkFreshReference ( GCReference* reference )
 {
-	if (!ptr)
-		return NULL;
-	GCObject* object = field->Lookup(ptr);
-	//ASSERT(object, "GetObject returned 0");
-	return object;
+	GCObject* src = reference->Owner();
+	reference->Target()->AddPointingReference(reference);
+#ifndef SINGLE_THREADED
+	// every thread allocating under the same owner, the root above all, would
+	// meet on its list and stripe, so the edge waits on this thread's own list.
+	// Nothing walks owned lists before adopting the nurseries, except from
+	// inside a write section, where the edge goes straight in
+	if (!globalLock.HeldExclusively())
+	{
+		GCThread* thread = CurrentThread();
+		reference->SetPending(true);
+		reference->Target()->SetPendingEdge(true);
+		reference->ownedNext = thread->pendingEdges;
+		thread->pendingEdges = reference;
+		return;
+	}
+#endif
+	edgeLocks.Lock(src, src);
+	src->AddOwnedReference(reference);
+	edgeLocks.Unlock(src, src);
 }
 
 void Unreference ( GCObject* src, GCObject* dst, bool isWeak )
 {
 	ASSERT(src, "Unreference with src=null");
 	ASSERT(dst, "Unreference with dst=null");
-	globalLock.WriteLock();
-	for (std::set<GCReference*>::iterator iter = src->ownedReferences.begin(); iter != src->ownedReferences.end(); iter++)
+	edgeLocks.Lock(src, dst);
+	GCReference* ref = src->FindOwnedReference(dst, isWeak);
+#ifndef SINGLE_THREADED
+	// a pending first edge is only on the target's list; it has no pointer
+	// location, so it is the one the search would have preferred
+	if (!isWeak && (!ref || ref->PointerLocation()))
 	{
-		GCReference* ref = *iter;
-		ASSERT(ref, "found null reference in owned references list");
-		if (ref->Target() != dst) // wrong target
-			continue;
-		if (ref->IsWeak() != isWeak) // looking for a different type
-			continue;
-		ref->OwnerDisowned();
+		GCReference* first = dst->PendingEdge();
+		if (first && first->Owner() == src)
+			ref = first;
+	}
+#endif
+	bool unreferenced = false, pending = false;
+	if (ref)
+	{
+		// a pending edge is still on another list, which frees it at the safepoint
+		pending = ref->IsPending();
+		if (pending)
+		{
+			ref->Drop();
+			dst->SetPendingEdge(false);
+		}
+		else
+		{
+			src->RemoveOwnedReference(ref);
+		}
+		dst->RemovePointingReference(ref);
+		unreferenced = !dst->IsReferenced();
+	}
+	// the stripes go before anything dies: finalisers may come back in here
+	edgeLocks.Unlock(src, dst);
+	if (!ref)
 		return;
+	if (!pending)
+		delete ref;
+	// the cycle under way may not have traced through this edge yet
+	if (!isWeak)
+		incremental.Shade(dst);
+	if (unreferenced)
+		TargetUnreferenced(dst);
+}
+
+void GCReference::OwnerDied ()
+{
+	target->RemovePointingReference(this);
+	TargetUnreferenced(target);
+	delete this;
+}
+
+void GCReference::TargetDied ()
+{
+	owner->RemoveOwnedReference(this);
+	if (IsWeak())
+	{
+		weakInvalidator(owner->Address(), pointerLocation);
+		//*pointerLocation = NULL;
 	}
-	globalLock.WriteUnlock();
+	else if (!shuttingDown) // crazy shiz does happen whilst shutting down
+	{
+		// only legitimate when the owner is going down in the same sweep, or in a
+		// later slice of the incremental one
+		ASSERT(owner->IsCondemned() || (incremental.Sweeping() && !owner->IsMarked(incremental.Epoch())), "target died with strong reference attached");
+	}
+	delete this;
+}
+
+void GCObject::Migrate ( void* newTarget, GCChunk* newChunk )
+{
+	// pointers registered from inside the payload move along with it
+	for (GCReference* ref = ownedReferences; ref; ref = ref->NextOwned())
+	{
+		char* location = (char*)ref->PointerLocation();
+		if (location >= (char*)address && location < (char*)address + selfAssignedLength)
+			ref->SetPointerLocation((void**)((char*)newTarget + (location - (char*)address)));
+	}
+	// update index
+	UnindexObject(this);
+	if (chunk)
+	{
+		// the old slot is ours to give back; a foreign destination is
+		// treated like malloc memory from here on, as before
+		allocator.Free(chunk, address);
+	}
+	address = newTarget;
+	chunk = newChunk;
+	IndexObject(this);
+	// update all references
+	for (GCReference* ref = pointingReferences; ref; ref = ref->NextPointing())
+	{
+		if (ref->PointerLocation())
+			*(ref->PointerLocation()) = newTarget;
+	}
+}
+
+#ifndef SINGLE_THREADED
+#define GC_BACKGROUND_SLICE 1024
+#define GC_BACKGROUND_PAUSE 500
+
+// runs a full collection every so often on a thread of its own. Marking goes on
+// in short read sections alongside the mutators; only the remark and the sweep
+// stop them, handed over in slices of about GC_BACKGROUND_PAUSE microseconds.
+class GCCollector
+{
+private:
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wakeCondition;
+	unsigned interval; // milliseconds between cycles
+	bool running;
+	bool exiting;
+	
+	static void* CollectorMain ( void* context )
+	{
+		GCCollector* collector = (GCCollector*)context;
+		pthread_mutex_lock(&collector->mutex);
+		while (!collector->exiting)
+		{
+			uint64_t wake = MicrosecondsNow() + collector->interval * (uint64_t)1000;
+			struct timespec deadline;
+			deadline.tv_sec = wake / 1000000;
+			deadline.tv_nsec = (wake % 1000000) * 1000;
+			while (!collector->exiting && pthread_cond_timedwait(&collector->wakeCondition, &collector->mutex, &deadline) != ETIMEDOUT)
+				;
+			if (collector->exiting)
+				break;
+			pthread_mutex_unlock(&collector->mutex);
+			collector->Cycle();
+			pthread_mutex_lock(&collector->mutex);
+		}
+		pthread_mutex_unlock(&collector->mutex);
+		return NULL;
+	}
+	
+	void Cycle ()
+	{
+		globalLock.WriteLock();
+		ReleaseQueued();
+		uint32_t epoch = incremental.Start();
+		globalLock.WriteUnlock();
+		bool marking = true;
+		uint64_t markStart = MicrosecondsNow();
+		while (marking)
+		{
+			globalLock.ReadLock();
+			marking = incremental.MarkConcurrently(epoch, GC_BACKGROUND_SLICE);
+			globalLock.ReadUnlock();
+		}
+		uint64_t markEnd = MicrosecondsNow(), concurrentMark = markEnd - markStart;
+		if (trace.Enabled())
+			trace.Record("concurrent mark", markStart, markEnd, NULL, 0);
+		// someone else may have finished this cycle and begun another in the meantime
+		bool finished = false;
+		while (!finished)
+		{
+			globalLock.WriteLock();
+			// not a pause, as mutators ran alongside
+			statistics.Marked(concurrentMark);
+			concurrentMark = 0;
+			ReleaseQueued();
+			finished = !incremental.Active() || incremental.Epoch() != epoch || incremental.Step(GC_BACKGROUND_PAUSE);
+			globalLock.WriteUnlock();
+		}
+	}
+public:
+	GCCollector () : interval(0), running(false), exiting(false) {}
+	
+	void Start ( unsigned anInterval )
+	{
+		if (!anInterval)
+			return;
+		interval = anInterval;
+		exiting = false;
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&wakeCondition, NULL);
+		pthread_create(&thread, NULL, CollectorMain, this);
+		running = true;
+	}
+	
+	// must not be called with the heap locked: the last cycle may still need it
+	void Stop ()
+	{
+		if (!running)
+			return;
+		pthread_mutex_lock(&mutex);
+		exiting = true;
+		pthread_cond_signal(&wakeCondition);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(thread, NULL);
+		pthread_cond_destroy(&wakeCondition);
+		pthread_mutex_destroy(&mutex);
+		running = false;
+	}
+};
+
+GCCollector collector;
+#endif
+
+#define GC_FINALISER_BATCH 64
+
+// finalisers of dead objects waiting to run, with the payloads they are given,
+// which are only freed once the calls have been made. Filled by whoever frees
+// objects, under the write lock; emptied from any thread without it, and
+// optionally by a thread of its own
+class GCFinaliserQueue
+{
+private:
+	struct Entry
+	{
+		void (*finaliser)(void*);
+		void* address;
+		GCChunk* chunk;
+		size_t length;
+	};
+	std::vector<Entry> entries;
+	size_t head;
+#ifndef SINGLE_THREADED
+	pthread_mutex_t mutex;
+	pthread_cond_t arrived;
+	pthread_t thread;
+	bool running;
+	bool exiting;
+	
+	static void* FinaliserMain ( void* context )
+	{
+		GCFinaliserQueue* queue = (GCFinaliserQueue*)context;
+		pthread_mutex_lock(&queue->mutex);
+		while (!queue->exiting)
+		{
+			if (queue->head == queue->entries.size())
+			{
+				pthread_cond_wait(&queue->arrived, &queue->mutex);
+				continue;
+			}
+			pthread_mutex_unlock(&queue->mutex);
+			queue->Run(0, true);
+			pthread_mutex_lock(&queue->mutex);
+		}
+		pthread_mutex_unlock(&queue->mutex);
+		return NULL;
+	}
+#endif
+	
+	void Lock ()
+	{
+#ifndef SINGLE_THREADED
+		pthread_mutex_lock(&mutex);
+#endif
+	}
+	
+	void Unlock ()
+	{
+#ifndef SINGLE_THREADED
+		pthread_mutex_unlock(&mutex);
+#endif
+	}
+	
+	// takes up to count from the front
+	void Take ( std::vector<Entry>& batch, size_t count )
+	{
+		Lock();
+		size_t available = entries.size() - head;
+		if (count > available)
+			count = available;
+		batch.assign(entries.begin() + head, entries.begin() + head + count);
+		head += count;
+		if (head == entries.size())
+		{
+			entries.clear();
+			head = 0;
+		}
+		Unlock();
+	}
+public:
+	bool deferring;
+	
+	GCFinaliserQueue () : head(0), deferring(false)
+	{
+#ifndef SINGLE_THREADED
+		running = exiting = false;
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&arrived, NULL);
+#endif
+	}
+	
+	bool Push ( void (*finaliser)(void*), void* address, GCChunk* chunk, size_t length )
+	{
+		if (!deferring || shuttingDown)
+			return false;
+		Entry entry = { finaliser, address, chunk, length };
+		Lock();
+		entries.push_back(entry);
+#ifndef SINGLE_THREADED
+		if (running)
+			pthread_cond_signal(&arrived);
+#endif
+		Unlock();
+		return true;
+	}
+	
+	// makes up to max calls, or all of them for 0, without the heap locked, and frees
+	// each batch's payloads once its calls are done; returns the number made
+	unsigned long Run ( unsigned long max, bool call )
+	{
+		std::vector<Entry> batch;
+		unsigned long done = 0;
+		for (;;)
+		{
+			size_t count = GC_FINALISER_BATCH;
+			if (max && max - done < count)
+				count = max - done;
+			Take(batch, count);
+			if (batch.empty())
+				break;
+			if (call)
+			{
+				GCTraceScope scope("finalise", "objects", batch.size());
+				for (size_t i = 0; i < batch.size(); i++)
+					batch[i].finaliser(batch[i].address);
+			}
+			globalLock.WriteLock();
+			if (call)
+				Counters().finalised += batch.size();
+			for (size_t i = 0; i < batch.size(); i++)
+			{
+				if (batch[i].chunk)
+					allocator.Free(batch[i].chunk, batch[i].address);
+				else if (batch[i].length > 0)
+					free(batch[i].address);
+				if (batch[i].length > 0)
+					AccountFreed(batch[i].length);
+			}
+			globalLock.WriteUnlock();
+			done += batch.size();
+			if (done == max)
+				break;
+		}
+		return done;
+	}
+	
+	void Start ()
+	{
+#ifndef SINGLE_THREADED
+		pthread_mutex_lock(&mutex);
+		exiting = false;
+		running = true;
+		pthread_mutex_unlock(&mutex);
+		pthread_create(&thread, NULL, FinaliserMain, this);
+#endif
+	}
+	
+	// leaves whatever is still queued; must not be called with the heap locked
+	void Stop ()
+	{
+#ifndef SINGLE_THREADED
+		if (!running)
+			return;
+		pthread_mutex_lock(&mutex);
+		exiting = true;
+		running = false;
+		pthread_cond_signal(&arrived);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(thread, NULL);
+#endif
+	}
+};
+
+GCFinaliserQueue finalisers;
+
+bool QueueFinaliser ( void (*finaliser)(void*), void* address, GCChunk* chunk, size_t length )
+{
+	return finalisers.Push(finaliser, address, chunk, length);
 }
 
-void GCWeakReference::OwnerDied ()
+#define GC_NO_VERTEX 0
+
+// the dominator tree of the strong references, rooted at the root object: an
+// object's immediate dominator is the last one every strong path to it passes
+// through, so it retains everything in its subtree. Built by semi-NCA
+// (Georgiadis), Lengauer and Tarjan's semidominators followed by a nearest
+// common ancestor walk, which is near linear in practice and much simpler than
+// their balanced version. Objects are numbered in depth-first preorder through
+// their mark words, so it needs the write lock and no collection under way.
+class GCDominators
 {
-	std::set<GCReference*>::iterator iter;
-	if (!target->IsCondemned())
+private:
+	// indexed by number, from 1 for the root; 0 is nothing
+	std::vector<GCObject*> vertex;
+	std::vector<uint32_t> parent; // in the search tree, and then the compressed forest
+	std::vector<uint32_t> semi;
+	std::vector<uint32_t> label;
+	std::vector<uint32_t> dominator;
+	std::vector<uint64_t> retainedBytes;
+	std::vector<uint32_t> retainedObjects;
+	std::vector<uint32_t> evalStack;
+	
+	uint32_t Visit ( GCObject* object, uint32_t from )
+	{
+		uint32_t number = (uint32_t)vertex.size();
+		object->SetNumber(number);
+		vertex.push_back(object);
+		parent.push_back(from);
+		return number;
+	}
+	
+	// numbers what is strongly reachable from the root, depth first
+	void Search ()
 	{
-		iter = target->pointingReferences.find(this);
-		ASSERT(iter != target->pointingReferences.end(), "reference isn't in pointing list");
-		target->pointingReferences.erase(iter);
-		if (!target->IsReferenced() && !disableTrivialExecution)
+		std::vector< std::pair<uint32_t, GCReference*> > stack;
+		vertex.assign(1, (GCObject*)NULL);
+		parent.assign(1, GC_NO_VERTEX);
+		uint32_t root = Visit(rootObject, GC_NO_VERTEX);
+		stack.push_back(std::make_pair(root, rootObject->OwnedReferences()));
+		while (!stack.empty())
 		{
-			DEBUG(printf("[GC] -OBJ %p (completely unreferenced)\n", target->Address()));
-			target->Condemn(NULL);
+			GCReference*& ref = stack.back().second;
+			if (!ref)
+			{
+				stack.pop_back();
+				continue;
+			}
+			GCObject* target = ref->Target();
+			bool follow = !ref->IsWeak() && target->Number() == GC_NO_VERTEX;
+			uint32_t from = stack.back().first;
+			ref = ref->NextOwned();
+			if (follow)
+				stack.push_back(std::make_pair(Visit(target, from), target->OwnedReferences()));
 		}
 	}
-	delete this;
-}
-
-void GCWeakReference::OwnerDisowned ()
-{
-	std::set<GCReference*>::iterator iter;
-	iter = owner->ownedReferences.find(this);
-	ASSERT(iter != owner->ownedReferences.end(), "reference isn't in owned list");
-	owner->ownedReferences.erase(iter);
-	if (!target->IsCondemned())
+	
+	// the vertex of least semidominator on the forest path up from v, compressing
+	// the path on the way; only vertices numbered above last are in the forest
+	uint32_t Eval ( uint32_t v, uint32_t last )
 	{
-		iter = target->pointingReferences.find(this);
-		ASSERT(iter != target->pointingReferences.end(), "reference isn't in pointing list");
-		target->pointingReferences.erase(iter);
-		if (!target->IsReferenced() && !disableTrivialExecution)
+		if (parent[v] < last)
+			return label[v];
+		evalStack.clear();
+		do
+		{
+			evalStack.push_back(v);
+			v = parent[v];
+		} while (parent[v] >= last);
+		uint32_t top = v;
+		uint32_t topLabel = label[top];
+		while (!evalStack.empty())
 		{
-			DEBUG(printf("[GC] -OBJ %p (completely unreferenced)\n", target->Address()));
-			target->Condemn(NULL);
+			v = evalStack.back();
+			evalStack.pop_back();
+			parent[v] = parent[top];
+			if (semi[topLabel] < semi[label[v]])
+				label[v] = topLabel;
+			else
+				topLabel = label[v];
+			top = v;
 		}
+		return label[v];
 	}
-	delete this;
-}
-
-void GCWeakReference::TargetDied ()
-{
-	std::set<GCReference*>::iterator iter;
-	iter = owner->ownedReferences.find(this);
-	ASSERT(iter != owner->ownedReferences.end(), "reference isn't in owned list");
-	owner->ownedReferences.erase(iter);
-	weakInvalidator(owner->Address(), pointerLocation);
-	//*pointerLocation = NULL;
-	delete this;
-}
-
-void GCStrongReference::OwnerDied ()
-{
-	std::set<GCReference*>::iterator iter;
-	if (!target->IsCondemned())
+	
+	void Build ()
 	{
-		iter = target->pointingReferences.find(this);
-		ASSERT(iter != target->pointingReferences.end(), "reference isn't in pointing list");
-		target->pointingReferences.erase(iter);
-		if (!target->IsReferenced() && !disableTrivialExecution)
+		uint32_t count = (uint32_t)vertex.size();
+		semi.resize(count);
+		label.resize(count);
+		dominator = parent;
+		for (uint32_t i = 0; i < count; i++)
+			semi[i] = label[i] = i;
+		for (uint32_t w = count - 1; w >= 2; w--)
 		{
-			DEBUG(printf("[GC] -OBJ %p (completely unreferenced)\n", target->Address()));
-			target->Condemn(NULL);
+			semi[w] = parent[w];
+			for (GCReference* ref = vertex[w]->PointingReferences(); ref; ref = ref->NextPointing())
+			{
+				uint32_t v = ref->Owner()->Number();
+				if (ref->IsWeak() || v == GC_NO_VERTEX)
+					continue;
+				uint32_t u = semi[Eval(v, w + 1)];
+				if (u < semi[w])
+					semi[w] = u;
+			}
+		}
+		for (uint32_t w = 2; w < count; w++)
+		{
+			uint32_t candidate = dominator[w];
+			while (candidate > semi[w])
+				candidate = dominator[candidate];
+			dominator[w] = candidate;
+		}
+		// dominators come before what they dominate in preorder
+		retainedBytes.resize(count);
+		retainedObjects.assign(count, 1);
+		for (uint32_t w = 1; w < count; w++)
+			retainedBytes[w] = vertex[w]->GetLength();
+		for (uint32_t w = count - 1; w >= 2; w--)
+		{
+			retainedBytes[dominator[w]] += retainedBytes[w];
+			retainedObjects[dominator[w]] += retainedObjects[w];
 		}
 	}
-	delete this;
-}
-
-void GCStrongReference::OwnerDisowned ()
-{
-	std::set<GCReference*>::iterator iter;
-	iter = owner->ownedReferences.find(this);
-	ASSERT(iter != owner->ownedReferences.end(), "reference isn't in owned list");
-	owner->ownedReferences.erase(iter);
-	if (!target->IsCondemned())
+	
+	void Clear ()
 	{
-		iter = target->pointingReferences.find(this);
-		ASSERT(iter != target->pointingReferences.end(), "reference isn't in pointing list");
-		target->pointingReferences.erase(iter);
-		if (!target->IsReferenced() && !disableTrivialExecution)
+		for (uint32_t i = 1; i < vertex.size(); i++)
+			vertex[i]->SetNumber(0);
+	}
+public:
+	// leaves every mark word at 0, so the next collection starts from nothing marked
+	void Compute ()
+	{
+		size_t objects = 1;
+		for (GCField* f = field; f; f = f->Parent())
 		{
-			DEBUG(printf("[GC] -OBJ %p (completely unreferenced)\n", target->Address()));
-			target->Condemn(NULL);
+			for (GCObject* object = f->Objects(); object; object = object->fieldNext, objects++)
+				object->SetNumber(0);
 		}
+		vertex.reserve(objects);
+		parent.reserve(objects);
+		Search();
+		Build();
+		Clear();
+		parent.clear();
+		semi.clear();
+		label.clear();
 	}
-	delete this;
+	
+	uint32_t Count () const { return (uint32_t)vertex.size(); }
+	GCObject* Vertex ( uint32_t number ) const { return vertex[number]; }
+	uint32_t Dominator ( uint32_t number ) const { return dominator[number]; }
+	uint64_t RetainedBytes ( uint32_t number ) const { return retainedBytes[number]; }
+	uint32_t RetainedObjects ( uint32_t number ) const { return retainedObjects[number]; }
+};
+
+// links a new object in under its owner; needs the read lock, and sets due if a
+// collection has become due, which the caller runs once the lock is dropped
+void BirthObject ( GCObject* obj, GCObject* owner, size_t len, bool& due )
+{
+	incremental.BornDuringCycle(obj);
+	GCReference* reference = new GCReference(owner, obj, NULL, 0);
+	ASSERT(reference, "could not allocate new GCReference");
+	LinkFreshReference(reference);
+	field->InsertShallow(obj);
+	NoteEdge(owner, obj);
+	if (triggers.Allocated(len))
+		due = true;
 }
 
-void GCStrongReference::TargetDied ()
+GCObject* NewObject ( size_t len, GCObject* owner, void (*finaliser)(void*), GCAllocator::Buffer& buffer, bool& due )
 {
-	// ...the hell?
-	std::set<GCReference*>::iterator iter;
-	if (!shuttingDown) // crazy shiz does happen whilst shutting down
-	{
-		ASSERT(0, "target died with strong reference attached");
-	}
-	iter = owner->ownedReferences.find(this);
-	ASSERT(iter != owner->ownedReferences.end(), "reference isn't in owned list");
-	owner->ownedReferences.erase(iter);
-	delete this;
+	GCChunk* chunk;
+	void* pointer = allocator.Allocate(len, &chunk, buffer);
+	memset(pointer, 0, len);
+	GCObject* obj = new GCObject(pointer, finaliser, len, chunk);
+	ASSERT(obj, "could not allocate new GCObject");
+	BirthObject(obj, owner, len, due);
+	return obj;
 }
 
-void GCObject::Migrate ( void* newTarget )
+GCObject* RegisterObject ( void* object, GCObject* owner, void (*finaliser)(void*), bool& due )
 {
-	// update field
-	void* oldAddress = address;
-	address = newTarget;
-	// update all references
-	for (std::set<GCReference*>::iterator iter = pointingReferences.begin(); iter != pointingReferences.end(); iter++)
-	{
-		GCReference* ref = *iter;
-		if (ref->PointerLocation())
-			*(ref->PointerLocation()) = newTarget;
-	}
-	// move in main map
-	field->Move(oldAddress, newTarget);
+	GCObject* obj = new GCObject(object, finaliser, 0, NULL);
+	ASSERT(obj, "could not allocate new GCObject");
+	BirthObject(obj, owner, 0, due);
+	return obj;
+}
+
+// needs the read lock
+void AddReference ( GCObject* src, GCObject* dst, void** pointer, bool isWeak )
+{
+	GCReference* reference = new GCReference(src, dst, pointer, isWeak ? GCReference::WEAK : 0);
+	ASSERT(reference, isWeak ? "could not allocate weak reference" : "could not allocate strong reference");
+	LinkReference(reference);
+	if (isWeak)
+		return;
+	NoteEdge(src, dst);
+	incremental.Shade(dst);
 }
 
 }
 
+void GC_default_config ( GC_config* config )
+{
+	config->markThreads = 1;
+	config->backgroundInterval = 0;
+	config->generations = FIELDCOUNT;
+	config->tenureAge = 1;
+	config->triggers.nurseryBytes = 0;
+	config->triggers.nurseryObjects = 0;
+	config->triggers.heapGrowth = 0;
+	config->deferFinalisers = false;
+	config->finaliserThread = false;
+	config->compactNursery = false;
+	config->traceEvents = 0;
+}
+
 void GC_init ()
+{
+	GC_config config;
+	GC_default_config(&config);
+	GC_init_with_config(&config);
+}
+
+void GC_init_with_config ( const GC_config* config )
 {
 	DEBUG(printf("[GC] doing GC init\n"));
 	DEBUG(printf("[GC] interesting stats:\n"));
@@ -732,71 +4177,179 @@ void GC_init ()
 	DEBUG(printf("[GC] \tsizeof(int) = %d\n", sizeof(int)));
 	DEBUG(printf("[GC] \tsizeof(GCObject) = %d\n", sizeof(GCObject)));
 	DEBUG(printf("[GC] \tsizeof(GCReference) = %d\n", sizeof(GCReference)));
-	DEBUG(printf("[GC] \tsizeof(GCStrongReference) = %d\n", sizeof(GCStrongReference)));
-	DEBUG(printf("[GC] \tsizeof(GCWeakReference) = %d\n", sizeof(GCWeakReference)));
 	DEBUG(printf("[GC] \tsizeof(GCField) = %d\n", sizeof(GCField)));
-	rootObject = new GCObject(GC_ROOT, 0, 0);
+	rootObject = new GCObject(GC_ROOT, 0, 0, NULL);
 	globalLock.WriteLock();
+	handles.HandleFor(rootObject);
+	fieldCount = config->generations ? config->generations : 1;
+	tenureAge = config->tenureAge ? config->tenureAge : 1;
+	if (tenureAge > GC_MAX_TENURE_AGE)
+		tenureAge = GC_MAX_TENURE_AGE;
+	compactNursery = config->compactNursery;
+	triggers.Reset(config->triggers);
+	statistics.Reset();
+	trace.Reset(config->traceEvents);
 	field = NULL;
-	for (int i = 0; i < FIELDCOUNT; i++)
-		field = new GCField(field);
+	for (int i = 0; i < fieldCount; i++)
+		field = new GCField(field, fieldCount - 1 - i);
 	field->InsertDeep(rootObject);
+	marker.Start(config->markThreads);
+	finalisers.deferring = config->deferFinalisers;
 	globalLock.WriteUnlock();
+#ifndef SINGLE_THREADED
+	collector.Start(config->backgroundInterval);
+#endif
+	if (config->deferFinalisers && config->finaliserThread)
+		finalisers.Start();
 }
 
 void GC_terminate ( bool callFinalisers )
 {
+#ifndef SINGLE_THREADED
+	collector.Stop();
+#endif
+	finalisers.Stop();
+	globalLock.WriteLock();
+	incremental.Abandon();
+	// the queue goes first, while everything its finalisers might look at is still there
+	finalisers.Run(0, callFinalisers);
+	finalisers.deferring = false;
 	disableFinalisers = !callFinalisers;
 	shuttingDown = true;
+	// everything goes, so there is no point cascading
+	disableTrivialExecution = true;
+	AdoptNurseries();
+#ifndef SINGLE_THREADED
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+		allocator.Retire(thread->allocation);
+#else
+	allocator.Retire(allocationBuffer);
+#endif
+	allocator.Retire(promotionBuffer);
 	delete field;
+	marker.Stop();
+	objectIndex.Clear();
+	handles.Clear();
+	allocator.ReleaseAll();
+#ifndef SINGLE_THREADED
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+	{
+		thread->objectCells.Drop();
+		thread->referenceCells.Drop();
+		thread->released.clear();
+		thread->remembered.clear();
+		thread->pendingBytes = thread->pendingObjects = 0;
+		thread->counters = GCCounters();
+	}
+	objectPool.pool.ReleaseAll();
+	referencePool.pool.ReleaseAll();
+#else
+	objectPool.ReleaseAll();
+	referencePool.ReleaseAll();
+	counters = GCCounters();
+#endif
+	disableTrivialExecution = false;
 	shuttingDown = false;
 	disableFinalisers = false;
+	globalLock.WriteUnlock();
 }
 
 void GC_collect ( bool partial )
 {
 	globalLock.WriteLock();
+	GCTraceScope scope("GC_collect", "partial", partial);
+	ReleaseQueued();
+	// an unfinished incremental cycle owns the mark bits
+	incremental.Finish();
 	DEBUG(printf("[GC] doing %s collection\n", partial ? "generational" : "full"));
 	(partial ? CollectPartial : CollectFull)();
 	DEBUG(printf("[GC] collection finished\n"));
 	globalLock.WriteUnlock();
 }
 
+unsigned long GC_run_finalisers ( unsigned long max )
+{
+	return finalisers.Run(max, true);
+}
+
+void GC_collect_auto ( GC_decision* decision )
+{
+	globalLock.WriteLock();
+	GCTraceScope scope("GC_collect_auto");
+	ReleaseQueued();
+	incremental.Finish();
+	double garbage;
+	int depth = ChooseDepth(garbage);
+	size_t objects = CountObjects(depth);
+	size_t before = CountObjects(fieldCount);
+	double expectedPause = objects * costPerObject;
+	DEBUG(printf("[GC] doing adaptive collection of %d generations, expecting %.0f garbage objects in %.0fus\n", depth, garbage, expectedPause));
+	uint64_t start = MicrosecondsNow();
+	CollectFields(depth);
+	if (decision)
+	{
+		decision->generations = depth;
+		decision->objects = objects;
+		decision->expectedGarbage = garbage;
+		decision->expectedPause = expectedPause;
+		decision->freed = before - CountObjects(fieldCount);
+		decision->pause = (double)(MicrosecondsNow() - start);
+	}
+	globalLock.WriteUnlock();
+}
+
+bool GC_collect_step ( unsigned long budget )
+{
+	globalLock.WriteLock();
+	ReleaseQueued();
+	bool finished = incremental.Step(budget);
+	globalLock.WriteUnlock();
+	return finished;
+}
+
 void* GC_new_object ( unsigned long len, void* owner, void (*finaliser)(void*) )
 {
 	if (len < sizeof(void*))
 		len = sizeof(void*);
-	void* pointer = calloc(1, len);
-	GCObject* obj = new GCObject(pointer, finaliser, len);
-	ASSERT(obj, "could not allocate new GCObject");
+	bool due = false;
 	globalLock.ReadLock();
-	GCObject* owningObject = GetObject(owner);
-	GCStrongReference* reference = new GCStrongReference(owningObject, obj, NULL);
-	ASSERT(reference, "could not allocate new GCStrongReference");
+	// read while the object is sure to be there: once the lock is dropped another
+	// thread may take its only reference away, and the collection below free it
+	void* address = NewObject(len, GetObject(owner), finaliser, AllocationBuffer(), due)->Address();
 	globalLock.ReadUnlock();
-	globalLock.WriteLock();
-	obj->pointingReferences.insert(reference);
-	owningObject->ownedReferences.insert(reference);
-	field->InsertShallow(obj);
-	globalLock.WriteUnlock();
-	return pointer;
+	if (due)
+		CollectDue();
+	return address;
+}
+
+void GC_new_objects ( void** objects, unsigned long count, unsigned long len, void* owner, void (*finaliser)(void*) )
+{
+	if (len < sizeof(void*))
+		len = sizeof(void*);
+	bool due = false;
+	for (unsigned long first = 0; first < count; first += GC_BATCH_SLICE)
+	{
+		unsigned long last = count - first > GC_BATCH_SLICE ? first + GC_BATCH_SLICE : count;
+		globalLock.ReadLock();
+		GCAllocator::Buffer& buffer = AllocationBuffer();
+		GCObject* owningObject = GetObject(owner);
+		for (unsigned long i = first; i < last; i++)
+			objects[i] = NewObject(len, owningObject, finaliser, buffer, due)->Address();
+		globalLock.ReadUnlock();
+	}
+	if (due)
+		CollectDue();
 }
 
 void GC_register_object ( void* object, void* owner, void (*finaliser)(void*) )
 {
 	ASSERT(object, "tried to register bad object");
-	GCObject* obj = new GCObject(object, finaliser, 0);
-	ASSERT(obj, "could not allocate new GCObject");
+	bool due = false;
 	globalLock.ReadLock();
-	GCObject* owningObject = GetObject(owner);
-	GCStrongReference* reference = new GCStrongReference(owningObject, obj, NULL);
-	ASSERT(reference, "could not allocate new GCStrongReference");
+	RegisterObject(object, GetObject(owner), finaliser, due);
 	globalLock.ReadUnlock();
-	globalLock.WriteLock();
-	obj->pointingReferences.insert(reference);
-	owningObject->ownedReferences.insert(reference);
-	field->InsertShallow(obj);
-	globalLock.WriteUnlock();
+	if (due)
+		CollectDue();
 }
 
 void GC_register_reference ( void* object, void* target, void** pointerLocation )
@@ -806,13 +4359,8 @@ void GC_register_reference ( void* object, void* target, void** pointerLocation
 	ASSERT(src, "could not get source object");
 	GCObject* dst = GetObject(target);
 	ASSERT(dst, "could not get destination object");
+	AddReference(src, dst, pointerLocation, false);
 	globalLock.ReadUnlock();
-	GCStrongReference* reference = new GCStrongReference(src, dst, pointerLocation);
-	ASSERT(reference, "could not allocate strong reference");
-	globalLock.WriteLock();
-	src->ownedReferences.insert(reference);
-	dst->pointingReferences.insert(reference);
-	globalLock.WriteUnlock();
 }
 
 void GC_unregister_reference ( void* object, void* target )
@@ -822,8 +4370,57 @@ void GC_unregister_reference ( void* object, void* target )
 	ASSERT(src, "could not get source object");
 	GCObject* dst = GetObject(target);
 	ASSERT(dst, "could not get destination object");
-	globalLock.ReadUnlock();
 	Unreference(src, dst, false);
+	ReadUnlockReleasing();
+}
+
+void GC_register_references ( const GC_edge* edges, unsigned long count )
+{
+	globalLock.ReadLock();
+	GCLookupCache lookups;
+	for (unsigned long i = 0; i < count; i++)
+	{
+		if (i && i % GC_BATCH_SLICE == 0)
+		{
+			// lets a waiting collection in, after which the lookups are done afresh
+			globalLock.ReadUnlock();
+			globalLock.ReadLock();
+			lookups = GCLookupCache();
+		}
+		GCObject* src = lookups.Get(edges[i].object);
+		ASSERT(src, "could not get source object");
+		GCObject* dst = lookups.Get(edges[i].target);
+		ASSERT(dst, "could not get destination object");
+		AddReference(src, dst, edges[i].pointer, false);
+	}
+	globalLock.ReadUnlock();
+}
+
+void GC_unregister_references ( const GC_edge* edges, unsigned long count )
+{
+	globalLock.ReadLock();
+	bool settle = BeginBatch();
+	GCLookupCache lookups;
+	for (unsigned long i = 0; i < count; i++)
+	{
+		if (i && i % GC_BATCH_SLICE == 0)
+		{
+			if (settle)
+				SettleBatch();
+			ReadUnlockReleasing();
+			globalLock.ReadLock();
+			settle = BeginBatch();
+			lookups = GCLookupCache();
+		}
+		GCObject* src = lookups.Get(edges[i].object);
+		ASSERT(src, "could not get source object");
+		GCObject* dst = lookups.Get(edges[i].target);
+		ASSERT(dst, "could not get destination object");
+		Unreference(src, dst, false);
+	}
+	if (settle)
+		SettleBatch();
+	ReadUnlockReleasing();
 }
 
 void GC_register_weak_reference ( void* object, void* target, void** pointer )
@@ -834,24 +4431,19 @@ void GC_register_weak_reference ( void* object, void* target, void** pointer )
 	ASSERT(src, "could not get source object");
 	GCObject* dst = GetObject(target);
 	ASSERT(dst, "could not get destination object");
+	AddReference(src, dst, pointer, true);
 	globalLock.ReadUnlock();
-	GCWeakReference* reference = new GCWeakReference(src, dst, pointer);
-	ASSERT(reference, "could not allocate weak reference");
-	globalLock.WriteLock();
-	src->ownedReferences.insert(reference);
-	dst->pointingReferences.insert(reference);
-	globalLock.WriteUnlock();
 }
 
-void GC_unregister_weak_reference ( void* object, void* target, void** pointer )
+void GC_unregister_weak_reference ( void* object, void* target )
 {
 	globalLock.ReadLock();
 	GCObject* src = GetObject(object);
 	ASSERT(src, "could not get src");
 	GCObject* dst = GetObject(target);
 	ASSERT(dst, "could not get dst");
-	globalLock.ReadUnlock();
 	Unreference(src, dst, true);
+	ReadUnlockReleasing();
 }
 
 bool GC_object_live ( void* object )
@@ -868,7 +4460,7 @@ void GC_object_migrate ( void* oldLocation, void* newLocation )
 	GCObject* src = GetObject(oldLocation);
 	ASSERT(src, "could not get old object for GC migration");
 	ASSERT(newLocation, "tried to move object to bad location");
-	src->Migrate(newLocation);
+	src->Migrate(newLocation, NULL);
 	globalLock.WriteUnlock();
 }
 
@@ -885,15 +4477,328 @@ unsigned long GC_object_size ( void* object )
 void GC_object_resize ( void* object, unsigned long newLength )
 {
 	ASSERT(newLength, "tried to resize object to null length");
-	globalLock.ReadLock();
+	globalLock.WriteLock();
 	GCObject* src = GetObject(object);
-	globalLock.ReadUnlock();
 	ASSERT(src, "could not get object to resize");
-	globalLock.WriteLock();
 	src->Resize(newLength);
 	globalLock.WriteUnlock();
 }
 
+GC_handle GC_new_object_h ( unsigned long len, GC_handle owner, void (*finaliser)(void*) )
+{
+	if (len < sizeof(void*))
+		len = sizeof(void*);
+	bool due = false;
+	globalLock.ReadLock();
+	GCObject* owningObject = handles.Resolve(owner);
+	ASSERT(owningObject, "could not get owner from handle");
+	GCObject* obj = NewObject(len, owningObject, finaliser, AllocationBuffer(), due);
+	GC_handle handle = handles.HandleFor(obj);
+	globalLock.ReadUnlock();
+	if (due)
+		CollectDue();
+	return handle;
+}
+
+GC_handle GC_register_object_h ( void* object, GC_handle owner, void (*finaliser)(void*) )
+{
+	ASSERT(object, "tried to register bad object");
+	bool due = false;
+	globalLock.ReadLock();
+	GCObject* owningObject = handles.Resolve(owner);
+	ASSERT(owningObject, "could not get owner from handle");
+	GC_handle handle = handles.HandleFor(RegisterObject(object, owningObject, finaliser, due));
+	globalLock.ReadUnlock();
+	if (due)
+		CollectDue();
+	return handle;
+}
+
+GC_handle GC_object_handle ( void* object )
+{
+	globalLock.ReadLock();
+	GCObject* obj = GetObject(object);
+	GC_handle handle = obj ? handles.HandleFor(obj) : GC_NULL_HANDLE;
+	globalLock.ReadUnlock();
+	return handle;
+}
+
+void* GC_object_address_h ( GC_handle object )
+{
+	globalLock.ReadLock();
+	GCObject* obj = handles.Resolve(object);
+	void* address = obj ? obj->Address() : NULL;
+	globalLock.ReadUnlock();
+	return address;
+}
+
+void GC_register_reference_h ( GC_handle object, GC_handle target, void** pointer )
+{
+	globalLock.ReadLock();
+	GCObject* src = handles.Resolve(object);
+	ASSERT(src, "could not get source object from handle");
+	GCObject* dst = handles.Resolve(target);
+	ASSERT(dst, "could not get destination object from handle");
+	AddReference(src, dst, pointer, false);
+	globalLock.ReadUnlock();
+}
+
+void GC_unregister_reference_h ( GC_handle object, GC_handle target )
+{
+	globalLock.ReadLock();
+	GCObject* src = handles.Resolve(object);
+	ASSERT(src, "could not get source object from handle");
+	GCObject* dst = handles.Resolve(target);
+	ASSERT(dst, "could not get destination object from handle");
+	Unreference(src, dst, false);
+	ReadUnlockReleasing();
+}
+
+void GC_register_weak_reference_h ( GC_handle object, GC_handle target, void** pointer )
+{
+	ASSERT(pointer, "tried to create weak reference with null location");
+	globalLock.ReadLock();
+	GCObject* src = handles.Resolve(object);
+	ASSERT(src, "could not get source object from handle");
+	GCObject* dst = handles.Resolve(target);
+	ASSERT(dst, "could not get destination object from handle");
+	AddReference(src, dst, pointer, true);
+	globalLock.ReadUnlock();
+}
+
+void GC_unregister_weak_reference_h ( GC_handle object, GC_handle target )
+{
+	globalLock.ReadLock();
+	GCObject* src = handles.Resolve(object);
+	ASSERT(src, "could not get source object from handle");
+	GCObject* dst = handles.Resolve(target);
+	ASSERT(dst, "could not get destination object from handle");
+	Unreference(src, dst, true);
+	ReadUnlockReleasing();
+}
+
+bool GC_object_live_h ( GC_handle object )
+{
+	globalLock.ReadLock();
+	GCObject* obj = handles.Resolve(object);
+	globalLock.ReadUnlock();
+	return obj != NULL;
+}
+
+unsigned long GC_object_size_h ( GC_handle object )
+{
+	globalLock.ReadLock();
+	GCObject* obj = handles.Resolve(object);
+	ASSERT(obj, "could not get object from handle to look up length");
+	unsigned long len = obj->GetLength();
+	globalLock.ReadUnlock();
+	return len;
+}
+
+void* GC_object_resize_h ( GC_handle object, unsigned long newLength )
+{
+	ASSERT(newLength, "tried to resize object to null length");
+	globalLock.WriteLock();
+	GCObject* obj = handles.Resolve(object);
+	ASSERT(obj, "could not get object from handle to resize");
+	obj->Resize(newLength);
+	void* address = obj->Address();
+	globalLock.WriteUnlock();
+	return address;
+}
+
+void GC_get_triggers ( GC_triggers* limits )
+{
+	globalLock.ReadLock();
+	*limits = triggers.Limits();
+	globalLock.ReadUnlock();
+}
+
+void GC_set_triggers ( const GC_triggers* limits )
+{
+	globalLock.WriteLock();
+	triggers.Set(*limits);
+	globalLock.WriteUnlock();
+}
+
+void GC_get_stats ( GC_stats* stats )
+{
+	memset(stats, 0, sizeof(*stats));
+	globalLock.WriteLock();
+	stats->generations = fieldCount < GC_STATS_GENERATIONS ? fieldCount : GC_STATS_GENERATIONS;
+	// youngest first, with any past the last slot counted in it
+	unsigned slot = 0;
+	for (GCField* f = field; f; f = f->Parent())
+	{
+		stats->objects[slot] += f->Count();
+		stats->bytes[slot] += f->Bytes();
+		if (slot + 1 < stats->generations)
+			slot++;
+	}
+	GCCounters total;
+#ifndef SINGLE_THREADED
+	for (GCThread* thread = AtomicLoadPointer(&threads); thread; thread = thread->next)
+	{
+		// what a thread has made since the last safepoint is young, though not yet in the nursery
+		stats->objects[0] += thread->nurseryCount;
+		stats->bytes[0] += thread->nurseryBytes;
+		total.strongReferences += thread->counters.strongReferences;
+		// first edges taken out since then wait for the safepoint to be freed
+		for (GCReference* ref = thread->pendingEdges; ref; ref = ref->ownedNext)
+		{
+			if (ref->IsDropped())
+				total.strongReferences--;
+		}
+		total.weakReferences += thread->counters.weakReferences;
+		total.finalised += thread->counters.finalised;
+	}
+#else
+	total = counters;
+#endif
+	stats->strongReferences = total.strongReferences;
+	stats->weakReferences = total.weakReferences;
+	stats->finalised = total.finalised;
+	for (int i = 0; i < GC_STATS_GENERATIONS; i++)
+		stats->collections[i] = statistics.collections[i];
+	stats->lastMark = (double)statistics.lastMark;
+	stats->lastSweep = (double)statistics.lastSweep;
+	stats->markTime = (double)statistics.markTime;
+	stats->sweepTime = (double)statistics.sweepTime;
+	stats->pauseTime = (double)statistics.pauseTime;
+	stats->longestPause = (double)statistics.longestPause;
+	stats->promoted = statistics.promoted;
+	globalLock.WriteUnlock();
+}
+
+bool GC_dump_heap ( const char* path )
+{
+	FILE* out = fopen(path, "wb");
+	if (!out)
+		return false;
+	globalLock.WriteLock();
+	AdoptNurseries();
+	// sorted and matched up by address in arrays of their own, since going
+	// through the objects for every lookup would miss the cache each time
+	std::vector< std::pair<void*, GCObject*> > sorted;
+	for (GCField* f = field; f; f = f->Parent())
+	{
+		for (GCObject* object = f->Objects(); object; object = object->fieldNext)
+			sorted.push_back(std::make_pair(object->Address(), object));
+	}
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<GC_heap_object> records(sorted.size());
+	std::vector<GC_heap_edge> edges;
+	std::vector< std::pair<void*, size_t> > targets; // the address each edge leads to
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		GCObject* object = sorted[i].second;
+		GC_heap_object& record = records[i];
+		memset(&record, 0, sizeof(record));
+		record.address = (unsigned long long)(uintptr_t)object->Address();
+		record.size = object->GetLength();
+		record.firstEdge = edges.size();
+		record.generation = (unsigned short)object->Generation();
+		record.flags = object->HasFinaliser() ? GC_HEAP_FINALISER : 0;
+		for (GCReference* ref = object->OwnedReferences(); ref; ref = ref->NextOwned())
+		{
+			GC_heap_edge edge = { ref->IsWeak() ? GC_HEAP_WEAK : 0 };
+			targets.push_back(std::make_pair(ref->Target()->Address(), edges.size()));
+			edges.push_back(edge);
+		}
+		record.edgeCount = (unsigned)(edges.size() - record.firstEdge);
+	}
+	globalLock.WriteUnlock();
+	std::sort(targets.begin(), targets.end());
+	size_t index = 0;
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		while (sorted[index].first < targets[i].first)
+			index++;
+		edges[targets[i].second].target |= (unsigned)index;
+	}
+	GC_heap_header header;
+	memcpy(header.magic, GC_HEAP_MAGIC, sizeof(header.magic));
+	header.objects = records.size();
+	header.edges = edges.size();
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+	               fwrite(&records[0], sizeof(GC_heap_object), records.size(), out) == records.size() &&
+	               (edges.empty() || fwrite(&edges[0], sizeof(GC_heap_edge), edges.size(), out) == edges.size());
+	return fclose(out) == 0 && written;
+}
+
+// the write lock must be held across both, since the numbers live in the objects
+static void ComputeDominators ( GCDominators& dominators )
+{
+	ReleaseQueued();
+	// an unfinished incremental cycle owns the mark words
+	incremental.Finish();
+	GCTraceScope scope("dominators");
+	dominators.Compute();
+	scope.SetArg(dominators.Count() - 1);
+}
+
+unsigned long long GC_retained_size ( void* object )
+{
+	GCDominators dominators;
+	globalLock.WriteLock();
+	ComputeDominators(dominators);
+	GCObject* target = GetObject(object);
+	unsigned long long bytes = 0;
+	for (uint32_t i = 1; i < dominators.Count(); i++)
+	{
+		if (dominators.Vertex(i) == target)
+			bytes = dominators.RetainedBytes(i);
+	}
+	globalLock.WriteUnlock();
+	return bytes;
+}
+
+unsigned long GC_largest_retainers ( GC_retained* largest, unsigned long count )
+{
+	GCDominators dominators;
+	globalLock.WriteLock();
+	ComputeDominators(dominators);
+	// the largest so far in a min-heap, so the smallest of them is the one to beat
+	typedef std::pair<uint64_t, uint32_t> Retainer; // retained bytes, number
+	typedef std::greater<Retainer> Larger;
+	std::vector<Retainer> heap;
+	for (uint32_t i = 2; i < dominators.Count() && count; i++)
+	{
+		Retainer entry(dominators.RetainedBytes(i), i);
+		if (heap.size() < count)
+		{
+			heap.push_back(entry);
+			std::push_heap(heap.begin(), heap.end(), Larger());
+		}
+		else if (entry.first > heap.front().first)
+		{
+			std::pop_heap(heap.begin(), heap.end(), Larger());
+			heap.back() = entry;
+			std::push_heap(heap.begin(), heap.end(), Larger());
+		}
+	}
+	std::sort_heap(heap.begin(), heap.end(), Larger());
+	for (size_t i = 0; i < heap.size(); i++)
+	{
+		uint32_t number = heap[i].second;
+		largest[i].object = dominators.Vertex(number)->Address();
+		largest[i].bytes = heap[i].first;
+		largest[i].objects = dominators.RetainedObjects(number);
+		largest[i].heldBy = dominators.Vertex(dominators.Dominator(number))->Address();
+	}
+	globalLock.WriteUnlock();
+	return (unsigned long)heap.size();
+}
+
+bool GC_dump_trace ( const char* path )
+{
+	FILE* out = fopen(path, "w");
+	if (!out)
+		return false;
+	bool written = trace.Write(out);
+	return fclose(out) == 0 && written;
+}
+
 void GC_weak_invalidator ( void (*invalidator)(void*, void**) )
 {
 	if (invalidator == NULL)
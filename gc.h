@@ -5,10 +5,119 @@ extern "C"
 #include <stdbool.h>
 #endif
 
+/**
+ * When allocation makes the GC collect by itself, checked as GC_new_object and GC_register_object
+ * return. A limit of 0 never triggers anything, and all three default to 0. With any of them set,
+ * an object may be freed as soon as it becomes unreachable, so never hand one out again once it is.
+ *
+ * In the thread-safe build each thread adds its allocation to the totals in batches of up to 64KB
+ * or 1024 objects, so limits much smaller than that are only roughly kept to.
+ */
+typedef struct GC_triggers
+{
+	/**
+	 * Bytes allocated since the last collection that start a partial collection.
+	 */
+	unsigned long nurseryBytes;
+	/**
+	 * Objects created or registered since the last collection that start a partial collection.
+	 */
+	unsigned long nurseryObjects;
+	/**
+	 * Percentage by which the heap may grow past the size the last full collection left before
+	 * the next allocation starts a full collection. A heap under 1MB counts as 1MB.
+	 */
+	unsigned heapGrowth;
+} GC_triggers;
+/**
+ * Tunable parameters for GC_init_with_config.
+ *
+ * Always fill one in with GC_default_config first, so that fields added later keep sensible values.
+ */
+typedef struct GC_config
+{
+	/**
+	 * Number of threads marking during a collection, counting the collecting thread.
+	 *
+	 * Values of 0 or 1 mark on the collecting thread alone.
+	 */
+	unsigned markThreads;
+	/**
+	 * Milliseconds between full collections run by a background collector thread, or 0 for none.
+	 *
+	 * The collector marks while other threads keep using the heap, stopping them only for the final
+	 * remark and the sweep, a fraction of a millisecond at a time. As with GC_collect_step, objects
+	 * that were unreachable when a collection began must not be given new references while it runs.
+	 * Only the thread-safe build (gc.cpp compiled with GC_THREAD_SAFE) has the collector; elsewhere
+	 * this is ignored. Defaults to 0.
+	 */
+	unsigned backgroundInterval;
+	/**
+	 * Number of generations. Partial collections only look at the youngest.
+	 *
+	 * 0 is taken as 1, where every collection is a full one. Defaults to 3.
+	 */
+	unsigned generations;
+	/**
+	 * Number of collections an object must survive in a generation before moving up to the next.
+	 *
+	 * Raising it keeps medium-lived objects out of the older generations, at the cost of tracing them
+	 * in more young collections. 0 is taken as 1, and values above 255 as 255. Defaults to 1.
+	 */
+	unsigned tenureAge;
+	/**
+	 * When to collect without being asked; see GC_triggers. Can be changed later with GC_set_triggers.
+	 */
+	GC_triggers triggers;
+	/**
+	 * Whether finalisers wait on a queue rather than running as their objects die.
+	 *
+	 * A collection then only queues the finalisers of what it frees, so however long they take stays
+	 * out of its pause. Queued finalisers run through GC_run_finalisers, or on the finaliser thread.
+	 * Each is still passed its object's address, which stays allocated until the call returns, but the
+	 * object is gone by then: GC_object_live is false for it, weak references to it have been cleared,
+	 * and it must not be handed back to the GC. Defaults to false.
+	 */
+	bool deferFinalisers;
+	/**
+	 * With deferFinalisers, run queued finalisers on a thread of the GC's own as they arrive.
+	 *
+	 * Only the thread-safe build (gc.cpp compiled with GC_THREAD_SAFE) has the thread; elsewhere this is
+	 * ignored. Defaults to false.
+	 */
+	bool finaliserThread;
+	/**
+	 * Whether objects leaving the youngest generation are copied out of it, packed together in the
+	 * order references lead from one to the next.
+	 *
+	 * Only objects from GC_new_object that every reference has a pointer for are moved, and each of
+	 * those pointers is updated, including ones inside the objects themselves. A reference without a
+	 * pointer, such as the one from the owner given when an object is created, pins its target. With
+	 * this set, keep an unpinned object's address nowhere but its registered pointers, since it may
+	 * change at any collection. Defaults to false.
+	 */
+	bool compactNursery;
+	/**
+	 * Number of collection phase events to keep for GC_dump_trace, the oldest making way for the newest,
+	 * or 0 to record none. Defaults to 0.
+	 *
+	 * Each event is a few dozen bytes. One is recorded per phase rather than per object, and the frees
+	 * set off by dropping a last reference are only recorded when they take 10 microseconds or more.
+	 */
+	unsigned traceEvents;
+} GC_config;
+/**
+ * Fill in the configuration GC_init uses.
+ */
+void GC_default_config ( GC_config* config );
 /**
  * Initialise the GC subsystem
  */
 void GC_init ();
+/**
+ * Initialise the GC subsystem with the given configuration
+ */
+void GC_init_with_config ( const GC_config* config );
 /**
  * SHUT DOWN EVERYTHING
  */
@@ -19,6 +128,72 @@ void GC_terminate ( bool callFinalisers );
  * @param partial Whether to make this is a small partial collection or a full collection.
  */
 void GC_collect ( bool partial );
+/**
+ * Run queued finalisers, oldest first, and free their objects' memory; see GC_config.deferFinalisers.
+ *
+ * The calls are made with the GC unlocked, so they may use it freely. Any thread may run finalisers,
+ * alongside the finaliser thread if there is one. GC_terminate runs whatever is left, or with
+ * callFinalisers false just frees it.
+ *
+ * @param max The most finalisers to run, or 0 for all of them.
+ * @return The number run.
+ */
+unsigned long GC_run_finalisers ( unsigned long max );
+/**
+ * What GC_collect_auto chose to do, and how it went, for logging.
+ */
+typedef struct GC_decision
+{
+	/**
+	 * Number of generations collected, youngest first. GC_config.generations means a full collection.
+	 */
+	unsigned generations;
+	/**
+	 * Objects in the collected generations going in.
+	 */
+	unsigned long objects;
+	/**
+	 * Objects the collection was expected to free, going by how earlier arrivals fared.
+	 */
+	double expectedGarbage;
+	/**
+	 * Expected pause in microseconds, going by the time earlier collections took per object.
+	 */
+	double expectedPause;
+	/**
+	 * Objects actually freed.
+	 */
+	unsigned long freed;
+	/**
+	 * Actual pause in microseconds.
+	 */
+	double pause;
+} GC_decision;
+/**
+ * Perform a GC collection as deep as past collections suggest is worth it.
+ *
+ * Each generation tracks what share of the objects arriving in it, by allocation or promotion, are
+ * found dead when it is next collected. Older generations are taken in while each is expected to free
+ * at least as much for every object it adds to the trace as the younger ones already chosen, so a
+ * longer pause only happens when it reclaims proportionally more. A large, settled generation with a
+ * little new garbage is left alone, as are old objects dropped in bulk: both wait for full
+ * collections, whether explicit or from GC_triggers.heapGrowth.
+ *
+ * @param decision Filled in with what was decided and what came of it, or NULL.
+ */
+void GC_collect_auto ( GC_decision* decision );
+/**
+ * Advance an incremental full collection, starting one if none is under way.
+ *
+ * Until the collection finishes, new objects survive it, and objects left without references are only
+ * released once it is over. Objects that were unreachable when the collection began are garbage
+ * from then on: do not register new references to them. GC_collect finishes an unfinished
+ * collection before doing its own.
+ *
+ * @param budget Roughly how long to spend, in microseconds.
+ * @return Whether the collection finished.
+ */
+bool GC_collect_step ( unsigned long budget );
 /**
  * Create a new object using the GC subsystem, assumed live.
  *
@@ -28,6 +203,18 @@ void GC_collect ( bool partial );
  * @param finaliser The function to call when finished, or NULL.
  */
 void* GC_new_object ( unsigned long len, void* owner, void (*finaliser)(void*) );
+/**
+ * Create several objects of the same length under one owner.
+ *
+ * Equivalent to calling GC_new_object count times, but the GC is locked once per few thousand objects
+ * and the owner is looked up once.
+ *
+ * @param objects Filled in with the new objects.
+ * @param count The number of objects to create.
+ * @param len The length of each object.
+ * @param finaliser The function each calls when finished, or NULL.
+ */
+void GC_new_objects ( void** objects, unsigned long count, unsigned long len, void* owner, void (*finaliser)(void*) );
 /**
  * Register an object with the GC subsystem, assumed live.
  *
@@ -47,10 +234,56 @@ void GC_register_reference ( void* object, void* target, void** pointer );
 /**
  * Unregister a reference to an object.
  *
+ * If the same reference was registered more than once, one without a pointer goes first; otherwise
+ * any one of the registrations is removed.
+ *
+ * In the thread-safe build (gc.cpp compiled with GC_THREAD_SAFE) a target left without references is
+ * released in a later batch, at the latest by the next GC_collect, and its finaliser runs on whichever
+ * thread releases it.
+ *
  * @param object The object containing the reference.
  * @param target The target of the reference.
  */
 void GC_unregister_reference ( void* object, void* target );
+/**
+ * One reference, for the batched calls below.
+ */
+typedef struct GC_edge
+{
+	/**
+	 * The object containing the reference.
+	 */
+	void* object;
+	/**
+	 * The target of the reference.
+	 */
+	void* target;
+	/**
+	 * As for GC_register_reference; ignored when unregistering.
+	 */
+	void** pointer;
+} GC_edge;
+/**
+ * Register several references at once.
+ *
+ * Equivalent to calling GC_register_reference for each in order, but the GC is locked once per few
+ * thousand references, and an object named repeatedly, such as one owner with many targets, is
+ * only looked up once.
+ *
+ * @param edges The references to register.
+ * @param count The number of references.
+ */
+void GC_register_references ( const GC_edge* edges, unsigned long count );
+/**
+ * Unregister several references at once.
+ *
+ * Equivalent to calling GC_unregister_reference for each in order, except that in the single-threaded
+ * build targets left without references are only released, and finalised, once the batch is done.
+ *
+ * @param edges The references to unregister.
+ * @param count The number of references.
+ */
+void GC_unregister_references ( const GC_edge* edges, unsigned long count );
 /**
  * The address of the GC root object
  */
@@ -87,6 +320,301 @@ unsigned long GC_object_size ( void* object );
  * Resizes a GC-allocated object.
  */
 void GC_object_resize ( void* object, unsigned long newLength );
+/**
+ * An object named by slot rather than address.
+ *
+ * Calls taking handles find the object directly instead of through the address index. A handle
+ * stays valid when its object moves, and once the object dies the handle no longer resolves:
+ * calls that need a live object fail their checks, GC_object_live_h returns false and
+ * GC_object_address_h returns NULL. Handles do not survive GC_terminate.
+ */
+typedef unsigned long long GC_handle;
+/**
+ * A handle that never resolves.
+ */
+#define GC_NULL_HANDLE ((GC_handle)0)
+/**
+ * The handle of the GC root object.
+ */
+#define GC_ROOT_HANDLE ((GC_handle)1 << 32)
+/**
+ * As GC_new_object, returning a handle.
+ */
+GC_handle GC_new_object_h ( unsigned long len, GC_handle owner, void (*finaliser)(void*) );
+/**
+ * As GC_register_object, returning a handle.
+ */
+GC_handle GC_register_object_h ( void* object, GC_handle owner, void (*finaliser)(void*) );
+/**
+ * The handle of an object made through the pointer calls, or GC_NULL_HANDLE if it is not live.
+ */
+GC_handle GC_object_handle ( void* object );
+/**
+ * The current address of an object, or NULL if it has died.
+ */
+void* GC_object_address_h ( GC_handle object );
+/**
+ * As GC_register_reference, with handles.
+ */
+void GC_register_reference_h ( GC_handle object, GC_handle target, void** pointer );
+/**
+ * As GC_unregister_reference, with handles.
+ */
+void GC_unregister_reference_h ( GC_handle object, GC_handle target );
+/**
+ * As GC_register_weak_reference, with handles.
+ */
+void GC_register_weak_reference_h ( GC_handle object, GC_handle target, void** pointer );
+/**
+ * As GC_unregister_weak_reference, with handles.
+ */
+void GC_unregister_weak_reference_h ( GC_handle object, GC_handle target );
+/**
+ * As GC_object_live, with a handle.
+ */
+bool GC_object_live_h ( GC_handle object );
+/**
+ * As GC_object_size, with a handle.
+ */
+unsigned long GC_object_size_h ( GC_handle object );
+/**
+ * As GC_object_resize, with a handle.
+ *
+ * @return The object's new address.
+ */
+void* GC_object_resize_h ( GC_handle object, unsigned long newLength );
+/**
+ * Reads the limits at which allocation starts a collection.
+ */
+void GC_get_triggers ( GC_triggers* triggers );
+/**
+ * Changes the limits at which allocation starts a collection.
+ */
+void GC_set_triggers ( const GC_triggers* triggers );
+/**
+ * Generations GC_stats reports on separately. Any beyond these are counted with the last.
+ */
+#define GC_STATS_GENERATIONS 8
+/**
+ * What the heap holds, and what collecting it has cost, since GC_init.
+ */
+typedef struct GC_stats
+{
+	/**
+	 * Number of generations, and so of the entries used in the arrays below, at most GC_STATS_GENERATIONS.
+	 */
+	unsigned generations;
+	/**
+	 * Live objects in each generation, youngest first. The root object counts in the oldest.
+	 */
+	unsigned long objects[GC_STATS_GENERATIONS];
+	/**
+	 * Bytes held by the live objects in each generation. Only memory from GC_new_object counts,
+	 * not objects passed to GC_register_object.
+	 */
+	unsigned long bytes[GC_STATS_GENERATIONS];
+	/**
+	 * Strong references registered, including those from owners given at creation.
+	 */
+	unsigned long strongReferences;
+	/**
+	 * Weak references registered.
+	 */
+	unsigned long weakReferences;
+	/**
+	 * Collections finished, by the number of generations they took in: the first entry counts those of
+	 * the youngest alone and entry generations - 1 full ones, which includes incremental and background
+	 * cycles.
+	 */
+	unsigned long collections[GC_STATS_GENERATIONS];
+	/**
+	 * Microseconds the last collection to finish spent marking.
+	 */
+	double lastMark;
+	/**
+	 * Microseconds the last collection to finish spent sweeping, which covers freeing what it found dead
+	 * and running or queueing their finalisers.
+	 */
+	double lastSweep;
+	/**
+	 * Total microseconds spent marking, including the background collector's marking alongside other threads.
+	 */
+	double markTime;
+	/**
+	 * Total microseconds spent sweeping.
+	 */
+	double sweepTime;
+	/**
+	 * Total microseconds collections held up other threads for: a whole collection for GC_collect,
+	 * GC_collect_auto and GC_triggers, and a step at a time for incremental and background cycles.
+	 */
+	double pauseTime;
+	/**
+	 * Microseconds of the longest of those pauses.
+	 */
+	double longestPause;
+	/**
+	 * Objects that survived into an older generation.
+	 */
+	unsigned long promoted;
+	/**
+	 * Finalisers that have run. With GC_config.deferFinalisers, those still queued are not counted.
+	 */
+	unsigned long finalised;
+} GC_stats;
+/**
+ * Reads the heap statistics.
+ *
+ * The counts are kept as the work is done, by each thread for itself where it can, so keeping them
+ * costs next to nothing. Reading them adds up the threads' counts with every other thread briefly
+ * stopped, so read them every so often rather than around each call.
+ */
+void GC_get_stats ( GC_stats* stats );
+/**
+ * The first eight bytes of a file written by GC_dump_heap.
+ */
+#define GC_HEAP_MAGIC "GCHEAP01"
+/**
+ * The start of a file written by GC_dump_heap.
+ *
+ * It is followed by the objects, as an array of GC_heap_object sorted by address, so the root object
+ * comes first, and then by the references, as an array of GC_heap_edge grouped by the object holding
+ * them, in the same order. Everything is in the byte order and alignment of the machine that wrote
+ * it, so the file can be mapped into memory and read in place.
+ */
+typedef struct GC_heap_header
+{
+	/**
+	 * GC_HEAP_MAGIC, without its terminating zero.
+	 */
+	char magic[8];
+	/**
+	 * Number of objects.
+	 */
+	unsigned long long objects;
+	/**
+	 * Number of references.
+	 */
+	unsigned long long edges;
+} GC_heap_header;
+/**
+ * Set in GC_heap_object.flags for an object with a finaliser.
+ */
+#define GC_HEAP_FINALISER 1
+/**
+ * One object in a heap dump.
+ */
+typedef struct GC_heap_object
+{
+	/**
+	 * Its address when the dump was taken.
+	 */
+	unsigned long long address;
+	/**
+	 * Its length, or 0 for an object passed to GC_register_object.
+	 */
+	unsigned long long size;
+	/**
+	 * Index of the first of its references among the edges.
+	 */
+	unsigned long long firstEdge;
+	/**
+	 * Number of references it holds.
+	 */
+	unsigned edgeCount;
+	/**
+	 * Its generation, 0 being the youngest.
+	 */
+	unsigned short generation;
+	/**
+	 * GC_HEAP_FINALISER, or 0.
+	 */
+	unsigned short flags;
+} GC_heap_object;
+/**
+ * Set in GC_heap_edge.target for a weak reference.
+ */
+#define GC_HEAP_WEAK 0x80000000u
+/**
+ * One reference in a heap dump.
+ */
+typedef struct GC_heap_edge
+{
+	/**
+	 * Index of the object it refers to, with GC_HEAP_WEAK set if it is weak.
+	 */
+	unsigned target;
+} GC_heap_edge;
+/**
+ * Writes every live object and every reference between them to a file, laid out as GC_heap_header
+ * describes. The heap analyser in tools/ reads it.
+ *
+ * Other threads are stopped while the heap is gathered up, but not while the file is written.
+ *
+ * @param path The file to write.
+ * @return Whether the file was written.
+ */
+bool GC_dump_heap ( const char* path );
+/**
+ * An object and what would be freed with it, from GC_largest_retainers.
+ */
+typedef struct GC_retained
+{
+	/**
+	 * The object.
+	 */
+	void* object;
+	/**
+	 * Bytes of the object and of every object only reachable through it, which would all be freed
+	 * once nothing else referred to it.
+	 */
+	unsigned long long bytes;
+	/**
+	 * How many objects those bytes are spread over, counting the object itself.
+	 */
+	unsigned long objects;
+	/**
+	 * The nearest object every strong path to it passes through, which retains it in turn; GC_ROOT
+	 * if nothing does.
+	 */
+	void* heldBy;
+} GC_retained;
+/**
+ * Works out how many bytes would be freed if an object died: its own, and those of every object
+ * that can only be reached from the root object through it. Weak references are not followed.
+ *
+ * This builds the dominator tree of every strong reference in the heap, which takes time in
+ * proportion to the objects and references, with other threads stopped throughout, so it is for
+ * deciding what to shrink rather than for calling around each allocation.
+ *
+ * @param object The object. GC_ROOT gives every reachable byte.
+ * @return The bytes, or 0 if the object cannot be reached through strong references.
+ */
+unsigned long long GC_retained_size ( void* object );
+/**
+ * Finds the objects that would free the most bytes if they died, as GC_retained_size measures
+ * them, in one pass over the heap.
+ *
+ * @param largest Filled in with the objects, largest first.
+ * @param count How many to find at most.
+ * @return How many were found, fewer than count only if fewer objects are reachable.
+ */
+unsigned long GC_largest_retainers ( GC_retained* largest, unsigned long count );
+/**
+ * Writes the events recorded with GC_config.traceEvents to a file in the Chrome trace event format,
+ * which chrome://tracing and Perfetto open.
+ *
+ * Each event is the time spent in one phase, on the thread that did it: whole collections from
+ * GC_collect, GC_collect_auto or GC_triggers, and within them the marking, the sweep of each generation,
+ * freeing what was found dead and, with GC_config.compactNursery, copying survivors. Incremental
+ * steps, the background collector's marking, cascades of objects freed on losing their last reference,
+ * and finalisers, a batch at a time, are recorded too. The events stay until the next GC_init, so they can
+ * be written out after GC_terminate.
+ *
+ * @param path The file to write.
+ * @return Whether the file was written.
+ */
+bool GC_dump_trace ( const char* path );
 /**
  * Sets the weak reference invalidator.
  *
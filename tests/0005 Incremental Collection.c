@@ -0,0 +1,42 @@
+#include "framework.h"
+
+static void FINISH ()
+{
+	int steps = 0;
+	while (!GC_collect_step(0))
+		ASSERT(++steps < 100000, "incremental collection never finished");
+}
+
+int main ()
+{
+	object obj1, obj2, obj3, obj4, obj5;
+	GC_init();
+	obj1 = NEW();
+	obj2 = NEW();
+	obj3 = NEW();
+	GC_register_reference(obj2, obj3, NULL);
+	GC_register_reference(obj3, obj2, NULL);
+	RELEASE(obj2);
+	RELEASE(obj3);
+	FINISH();
+	ASSERTLIVE(obj1);
+	ASSERTDEAD(obj2);
+	ASSERTDEAD(obj3);
+	ASSERTFINAL(obj2);
+	ASSERTFINAL(obj3);
+	GC_collect_step(0);
+	obj4 = NEW();
+	RELEASE(obj1);
+	FINISH();
+	ASSERTLIVE(obj4);
+	obj5 = GC_new_object(10, obj4, __finaliser);
+	GC_collect_step(0);
+	RELEASE(obj4);
+	GC_collect(0);
+	ASSERTDEAD(obj1);
+	ASSERTDEAD(obj4);
+	ASSERTDEAD(obj5);
+	ASSERTFINAL(obj1);
+	GC_terminate(0);
+	return 0;
+}
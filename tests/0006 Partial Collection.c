@@ -0,0 +1,35 @@
+#include "framework.h"
+
+int main ()
+{
+	object old1, old2, young1, young2, young3;
+	GC_init();
+	old1 = NEW();
+	old2 = GC_new_object(10, old1, __finaliser);
+	GC_collect(1);
+	GC_collect(1);
+	// only old objects hold the young ones
+	young1 = GC_new_object(10, old2, __finaliser);
+	young2 = NEW();
+	young3 = GC_new_object(10, young2, __finaliser);
+	GC_register_reference(old2, young2, NULL);
+	RELEASE(young2);
+	GC_collect(1);
+	ASSERTLIVE(young1);
+	ASSERTLIVE(young2);
+	ASSERTLIVE(young3);
+	GC_unregister_reference(old2, young2);
+	GC_collect(0);
+	ASSERTLIVE(old2);
+	ASSERTLIVE(young1);
+	ASSERTDEAD(young2);
+	ASSERTDEAD(young3);
+	ASSERTFINAL(young3);
+	RELEASE(old1);
+	GC_collect(0);
+	ASSERTDEAD(old1);
+	ASSERTDEAD(old2);
+	ASSERTDEAD(young1);
+	GC_terminate(0);
+	return 0;
+}
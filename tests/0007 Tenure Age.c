@@ -0,0 +1,57 @@
+#include "framework.h"
+
+int main ()
+{
+	object obj1, obj2, obj3;
+	GC_config config;
+	GC_stats stats;
+	int cycle;
+	GC_default_config(&config);
+	config.generations = 2;
+	config.tenureAge = 3;
+	GC_init_with_config(&config);
+	obj1 = NEW();
+	obj2 = NEW();
+	obj3 = GC_new_object(10, obj1, __finaliser);
+	GC_register_reference(obj3, obj1, NULL);
+	GC_register_reference(obj2, obj2, NULL);
+	GC_collect(1);
+	GC_collect(1);
+	// two collections survived: still young enough for a partial collection
+	RELEASE(obj1);
+	GC_collect(1);
+	ASSERTDEAD(obj1);
+	ASSERTDEAD(obj3);
+	ASSERTFINAL(obj1);
+	ASSERTFINAL(obj3);
+	// the third moved the survivor up, out of their reach
+	RELEASE(obj2);
+	GC_collect(1);
+	ASSERTLIVE(obj2);
+	GC_collect(0);
+	ASSERTDEAD(obj2);
+	GC_terminate(0);
+	// incremental cycles age survivors the same way, a field at a time
+	config.generations = 3;
+	config.tenureAge = 4;
+	GC_init_with_config(&config);
+	obj1 = NEW();
+	for (cycle = 1; cycle <= 4; cycle++)
+	{
+		while (!GC_collect_step(0))
+			;
+		GC_get_stats(&stats);
+		if (cycle < 4)
+		{
+			ASSERT(stats.objects[0] == 1 && stats.objects[1] == 0, "survivor moved up too early");
+		}
+		else
+		{
+			ASSERT(stats.objects[0] == 0 && stats.objects[1] == 1, "survivor did not move up");
+		}
+		ASSERT(stats.promoted == (cycle == 4), "promotions miscounted");
+	}
+	ASSERTLIVE(obj1);
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,30 @@
+#include "framework.h"
+
+int main ()
+{
+	object obj1, obj2, obj3;
+	GC_triggers triggers;
+	int i;
+	GC_init();
+	GC_get_triggers(&triggers);
+	ASSERT(triggers.nurseryBytes == 0 && triggers.nurseryObjects == 0 && triggers.heapGrowth == 0, "triggers on by default");
+	triggers.nurseryObjects = 100;
+	GC_set_triggers(&triggers);
+	GC_get_triggers(&triggers);
+	ASSERT(triggers.nurseryObjects == 100, "trigger not kept");
+	obj1 = NEW();
+	obj2 = NEW();
+	obj3 = NEW();
+	GC_register_reference(obj1, obj2, NULL);
+	GC_register_reference(obj2, obj1, NULL);
+	RELEASE(obj1);
+	RELEASE(obj2);
+	for (i = 0; i < 2000; i++)
+		RELEASE(NEW());
+	ASSERTDEAD(obj1);
+	ASSERTDEAD(obj2);
+	ASSERTLIVE(obj3);
+	ASSERTFINAL(obj1);
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "framework.h"
+
+#define COUNT 3000
+#define SETTLED 50000
+#define ARRIVED 12000
+
+int main ()
+{
+	static object settled[SETTLED], arrived[ARRIVED];
+	object objects[COUNT];
+	object young;
+	GC_decision decision;
+	GC_config config;
+	GC_stats stats;
+	int i;
+	GC_init();
+	// self-references keep them from going the moment they are released
+	for (i = 0; i < COUNT; i++)
+	{
+		objects[i] = GC_new_object(10, GC_ROOT, NULL);
+		GC_register_reference(objects[i], objects[i], NULL);
+	}
+	GC_collect_auto(&decision);
+	ASSERT(decision.generations == 1, "nothing older to collect");
+	ASSERT(decision.objects == COUNT, "wrong object count");
+	ASSERT(decision.freed == 0, "live objects freed");
+	// the promoted objects are now expected to be worth a deeper collection
+	for (i = 0; i < COUNT; i++)
+		RELEASE(objects[i]);
+	young = NEW();
+	GC_collect_auto(&decision);
+	ASSERT(decision.generations == 2, "promoted garbage not collected");
+	ASSERT(decision.expectedGarbage > 0, "no garbage expected");
+	ASSERT(decision.freed == COUNT, "wrong number freed");
+	ASSERT(decision.pause >= 0, "negative pause");
+	ASSERTDEAD(objects[0]);
+	ASSERTDEAD(objects[COUNT - 1]);
+	ASSERTLIVE(young);
+	RELEASE(young);
+	GC_collect_auto(NULL);
+	ASSERTDEAD(young);
+	GC_terminate(0);
+	// a large settled old generation with a little new garbage in it is not worth
+	// tracing for that, even when it holds more garbage than the young one
+	GC_default_config(&config);
+	config.generations = 2;
+	GC_init_with_config(&config);
+	for (i = 0; i < SETTLED; i++)
+		settled[i] = GC_new_object(10, GC_ROOT, NULL);
+	GC_collect(0);
+	GC_collect(0);
+	for (i = 0; i < ARRIVED; i++)
+	{
+		arrived[i] = GC_new_object(10, GC_ROOT, NULL);
+		GC_register_reference(arrived[i], arrived[i], NULL);
+	}
+	GC_collect_auto(&decision);
+	ASSERT(decision.generations == 1, "young objects not collected alone");
+	for (i = 0; i < ARRIVED; i += 2)
+		RELEASE(arrived[i]);
+	for (i = 0; i < COUNT; i++)
+	{
+		objects[i] = GC_new_object(10, GC_ROOT, NULL);
+		GC_register_reference(objects[i], objects[i], NULL);
+		RELEASE(objects[i]);
+	}
+	GC_collect_auto(&decision);
+	ASSERT(decision.expectedGarbage < 1024, "old garbage counted in a young collection");
+	ASSERT(decision.generations == 1, "settled generation traced for a little garbage");
+	ASSERT(decision.objects == COUNT, "wrong object count");
+	ASSERT(decision.freed == COUNT, "wrong number freed");
+	ASSERTDEAD(objects[0]);
+	ASSERTLIVE(arrived[0]);
+	GC_get_stats(&stats);
+	ASSERT(stats.objects[1] == SETTLED + ARRIVED + 1, "old generation collected");
+	GC_collect(0);
+	ASSERTDEAD(arrived[0]);
+	ASSERTLIVE(arrived[1]);
+	ASSERTLIVE(settled[0]);
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include "framework.h"
+
+#define COUNT 100
+
+int main ()
+{
+	object objects[COUNT];
+	GC_edge edges[COUNT];
+	object parent, chain1, chain2;
+	int i;
+	GC_init();
+	parent = NEW();
+	GC_new_objects(objects, COUNT, 10, GC_ROOT, __finaliser);
+	for (i = 0; i < COUNT; i++)
+	{
+		ASSERTLIVE(objects[i]);
+		ASSERT(GC_object_size(objects[i]) == 10, "wrong size");
+		edges[i].object = parent;
+		edges[i].target = objects[i];
+		edges[i].pointer = NULL;
+	}
+	GC_register_references(edges, COUNT);
+	for (i = 0; i < COUNT; i++)
+		edges[i].object = GC_ROOT;
+	GC_unregister_references(edges, COUNT);
+	GC_collect(0);
+	for (i = 0; i < COUNT; i++)
+		ASSERTLIVE(objects[i]);
+	for (i = 0; i < COUNT; i++)
+		edges[i].object = parent;
+	GC_unregister_references(edges, COUNT);
+	GC_collect(0);
+	for (i = 0; i < COUNT; i++)
+	{
+		ASSERTDEAD(objects[i]);
+		ASSERTFINAL(objects[i]);
+	}
+	ASSERTLIVE(parent);
+	// the first edge going leaves chain1 unreferenced, but it is still named by the second
+	chain1 = GC_new_object(10, parent, __finaliser);
+	chain2 = GC_new_object(10, chain1, __finaliser);
+	edges[0].object = parent;
+	edges[0].target = chain1;
+	edges[1].object = chain1;
+	edges[1].target = chain2;
+	GC_unregister_references(edges, 2);
+	GC_collect(0);
+	ASSERTDEAD(chain1);
+	ASSERTDEAD(chain2);
+	ASSERTFINAL(chain2);
+	GC_terminate(0);
+	return 0;
+}
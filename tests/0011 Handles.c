@@ -0,0 +1,41 @@
+#include "framework.h"
+
+int main ()
+{
+	GC_handle obj1, obj2, obj3, reused;
+	void* address;
+	void* weak;
+	GC_init();
+	obj1 = GC_new_object_h(10, GC_ROOT_HANDLE, __finaliser);
+	obj2 = GC_new_object_h(10, obj1, __finaliser);
+	address = GC_object_address_h(obj2);
+	ASSERT(address && GC_object_live(address), "handle address not live");
+	ASSERT(GC_object_handle(address) == obj2, "handle not found from address");
+	ASSERT(GC_object_size_h(obj2) == 10, "wrong size");
+	ASSERT(GC_object_live_h(GC_ROOT_HANDLE), "root handle does not resolve");
+	ASSERT(!GC_object_live_h(GC_NULL_HANDLE), "null handle resolves");
+	// a handle for an object made through the pointer calls
+	obj3 = GC_object_handle(NEW());
+	weak = GC_object_address_h(obj3);
+	GC_register_weak_reference_h(obj1, obj3, &weak);
+	GC_unregister_reference_h(GC_ROOT_HANDLE, obj3);
+	GC_collect(0);
+	ASSERT(!GC_object_live_h(obj3), "object survived unexpectedly");
+	ASSERTWRZ(weak);
+	// the handle follows the object when it moves
+	GC_register_reference_h(GC_ROOT_HANDLE, obj2, NULL);
+	address = GC_object_resize_h(obj2, 4000);
+	ASSERT(GC_object_address_h(obj2) == address, "handle lost track of resized object");
+	ASSERT(GC_object_size_h(obj2) == 4000, "wrong size after resize");
+	GC_unregister_reference_h(GC_ROOT_HANDLE, obj1);
+	GC_collect(0);
+	ASSERT(!GC_object_live_h(obj1), "object survived unexpectedly");
+	ASSERT(GC_object_live_h(obj2), "object murdered");
+	// a dead object's slot is reused, but its old handle stays dead
+	reused = GC_new_object_h(10, GC_ROOT_HANDLE, NULL);
+	ASSERT(reused != obj1 && reused != obj3, "stale handle handed out again");
+	ASSERT(!GC_object_live_h(obj1), "stale handle resolved");
+	ASSERT(!GC_object_live_h(obj3), "stale handle resolved");
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include "framework.h"
+
+#define COUNT 500
+
+int main ()
+{
+	object hub, children[COUNT];
+	void* weak[COUNT];
+	int i;
+	GC_init();
+	hub = NEW();
+	for (i = 0; i < COUNT; i++)
+	{
+		children[i] = NEW();
+		GC_register_reference(hub, children[i], NULL);
+		RELEASE(children[i]);
+	}
+	// a second strong edge and a weak one to every even child
+	for (i = 0; i < COUNT; i += 2)
+	{
+		GC_register_reference(hub, children[i], NULL);
+		weak[i] = children[i];
+		GC_register_weak_reference(hub, children[i], &weak[i]);
+	}
+	// oldest first, so each search would otherwise walk the whole list
+	for (i = 0; i < COUNT; i++)
+		GC_unregister_reference(hub, children[i]);
+	GC_collect(0);
+	for (i = 0; i < COUNT; i++)
+	{
+		if (i % 2)
+		{
+			ASSERTDEAD(children[i]);
+			ASSERTFINAL(children[i]);
+		}
+		else
+		{
+			ASSERTLIVE(children[i]);
+			ASSERTWRL(weak[i]);
+		}
+	}
+	// dropping the weak edge leaves the strong duplicate in place
+	for (i = 0; i < COUNT; i += 2)
+		GC_unregister_weak_reference(hub, children[i]);
+	GC_collect(0);
+	for (i = 0; i < COUNT; i += 2)
+		ASSERTLIVE(children[i]);
+	for (i = 0; i < COUNT; i += 2)
+		GC_unregister_reference(hub, children[i]);
+	GC_collect(0);
+	for (i = 0; i < COUNT; i += 2)
+		ASSERTDEAD(children[i]);
+	// the emptied hub takes edges again
+	children[0] = NEW();
+	GC_register_reference(hub, children[0], NULL);
+	RELEASE(children[0]);
+	GC_collect(0);
+	ASSERTLIVE(children[0]);
+	GC_unregister_reference(hub, children[0]);
+	GC_collect(0);
+	ASSERTDEAD(children[0]);
+	ASSERTLIVE(hub);
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,25 @@
+#include "framework.h"
+
+#define LENGTH 200000
+
+int main ()
+{
+	object head, tail, next;
+	int i;
+	GC_init();
+	head = NEW();
+	tail = head;
+	for (i = 1; i < LENGTH; i++)
+		tail = GC_new_object(10, tail, NULL);
+	next = GC_new_object(10, tail, __finaliser);
+	// far deeper than a cascade of destructors would fit on the stack
+	RELEASE(head);
+	GC_collect(1);
+	ASSERTDEAD(head);
+	ASSERTDEAD(tail);
+	ASSERTDEAD(next);
+	ASSERTFINAL(head);
+	ASSERTFINAL(next);
+	GC_terminate(0);
+	return 0;
+}
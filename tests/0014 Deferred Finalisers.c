@@ -0,0 +1,55 @@
+#include "framework.h"
+#include <string.h>
+
+static int intact = 1;
+
+static void CHECKING ( void* ptr )
+{
+	if (strcmp((char*)ptr, "payload"))
+		intact = 0;
+	__finaliser(ptr);
+}
+
+int main ()
+{
+	GC_config config;
+	object obj1, obj2, obj3, obj4;
+	void* weak;
+	GC_default_config(&config);
+	config.deferFinalisers = 1;
+	GC_init_with_config(&config);
+	obj1 = GC_new_object(10, GC_ROOT, CHECKING);
+	strcpy((char*)obj1, "payload");
+	obj2 = NEW();
+	obj3 = NEW();
+	weak = obj1;
+	GC_register_weak_reference(GC_ROOT, obj1, &weak);
+	RELEASE(obj1);
+	RELEASE(obj2);
+	RELEASE(obj3);
+	GC_collect(0);
+	// gone, but not yet finalised
+	ASSERTDEAD(obj1);
+	ASSERTDEAD(obj2);
+	ASSERTWRZ(weak);
+	ASSERTNOFINAL(obj1);
+	ASSERTNOFINAL(obj2);
+	ASSERTNOFINAL(obj3);
+	// in the order they died: obj1 was held by its weak reference until the collection
+	ASSERT(GC_run_finalisers(2) == 2, "ran the wrong number of finalisers");
+	ASSERTFINAL(obj2);
+	ASSERTFINAL(obj3);
+	ASSERTNOFINAL(obj1);
+	ASSERT(GC_run_finalisers(0) == 1, "ran the wrong number of finalisers");
+	ASSERTFINAL(obj1);
+	ASSERT(intact, "payload freed before its finaliser ran");
+	ASSERT(GC_run_finalisers(0) == 0, "ran a finaliser twice");
+	// what is still queued at shutdown runs then
+	obj4 = NEW();
+	RELEASE(obj4);
+	GC_collect(0);
+	ASSERTNOFINAL(obj4);
+	GC_terminate(1);
+	ASSERTFINAL(obj4);
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include "framework.h"
+#include <string.h>
+
+typedef struct node
+{
+	struct node* next;
+	char name[8];
+} node;
+
+// a node linked in through its owner's next pointer, and nothing else
+static node* APPEND ( node* owner, const char* name )
+{
+	node* added = (node*)GC_new_object(sizeof(node), owner, NULL);
+	strcpy(added->name, name);
+	owner->next = added;
+	GC_register_reference(owner, added, (void**)&owner->next);
+	GC_unregister_reference(owner, added);
+	RELEASE(NEW());
+	return added;
+}
+
+int main ()
+{
+	GC_config config;
+	node* holder;
+	node* a;
+	node* b;
+	node* c;
+	object pinned;
+	void* weak;
+	GC_default_config(&config);
+	config.compactNursery = 1;
+	GC_init_with_config(&config);
+	holder = (node*)GC_new_object(sizeof(node), GC_ROOT, NULL);
+	a = APPEND(holder, "a");
+	b = APPEND(a, "b");
+	c = APPEND(b, "c");
+	pinned = NEW();
+	weak = a;
+	GC_register_weak_reference(GC_ROOT, a, &weak);
+	GC_collect(1);
+	// everything reached through registered pointers has moved, with them updated
+	ASSERT(holder->next != a, "unpinned object not moved");
+	ASSERTDEAD(a);
+	ASSERT(weak == holder->next, "weak pointer not updated");
+	a = holder->next;
+	b = a->next;
+	c = b->next;
+	ASSERT(!strcmp(a->name, "a") && !strcmp(b->name, "b") && !strcmp(c->name, "c"), "contents lost in copying");
+	ASSERT(c->next == NULL, "chain corrupted in copying");
+	ASSERTLIVE(a);
+	ASSERTLIVE(b);
+	ASSERTLIVE(c);
+	// laid out in the order they are reached
+	ASSERT((char*)b - (char*)a == (char*)c - (char*)b && b > a, "copies not laid out in order");
+	// held without a pointer, so left where they are
+	ASSERTLIVE(holder);
+	ASSERTLIVE(pinned);
+	GC_unregister_reference(holder, a);
+	GC_collect(0);
+	ASSERTDEAD(a);
+	ASSERTDEAD(c);
+	ASSERTWRZ(weak);
+	GC_terminate(0);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include "framework.h"
+
+int main ()
+{
+	GC_stats stats;
+	object obj1, obj2;
+	void* weak;
+	GC_init();
+	GC_get_stats(&stats);
+	ASSERT(stats.generations == 3, "wrong number of generations");
+	ASSERT(stats.objects[0] == 0 && stats.objects[2] == 1, "root object miscounted");
+	ASSERT(stats.strongReferences == 0 && stats.weakReferences == 0, "references counted on an empty heap");
+	obj1 = NEW();
+	obj2 = NEW();
+	GC_register_reference(obj1, obj2, NULL);
+	weak = obj1;
+	GC_register_weak_reference(GC_ROOT, obj1, &weak);
+	GC_get_stats(&stats);
+	ASSERT(stats.objects[0] == 2 && stats.bytes[0] == 20, "new objects miscounted");
+	ASSERT(stats.strongReferences == 3, "strong references miscounted");
+	ASSERT(stats.weakReferences == 1, "weak references miscounted");
+	// one dropped as soon as it is made takes its reference with it
+	RELEASE(GC_new_object(10, GC_ROOT, NULL));
+	GC_get_stats(&stats);
+	ASSERT(stats.strongReferences == 3, "dropped reference still counted");
+	// both survive into the next generation up
+	GC_collect(1);
+	GC_get_stats(&stats);
+	ASSERT(stats.collections[0] == 1 && stats.collections[2] == 0, "partial collection miscounted");
+	ASSERT(stats.promoted == 2, "promotions miscounted");
+	ASSERT(stats.objects[0] == 0 && stats.objects[1] == 2 && stats.bytes[1] == 20, "survivors miscounted");
+	ASSERT(stats.pauseTime >= stats.lastMark + stats.lastSweep, "pause shorter than the collection");
+	GC_object_resize(obj1, 100);
+	obj1 = weak;
+	GC_get_stats(&stats);
+	ASSERT(stats.bytes[1] == 110, "resize not counted");
+	RELEASE(obj1);
+	RELEASE(obj2);
+	GC_collect(0);
+	GC_get_stats(&stats);
+	ASSERT(stats.collections[2] == 1, "full collection miscounted");
+	ASSERT(stats.objects[0] == 0 && stats.objects[1] == 0 && stats.bytes[1] == 0, "dead objects still counted");
+	ASSERT(stats.strongReferences == 0 && stats.weakReferences == 0, "dead references still counted");
+	ASSERT(stats.finalised == 2, "finalisers miscounted");
+	// an incremental cycle counts as a full collection once it ends
+	while (!GC_collect_step(0))
+		;
+	GC_get_stats(&stats);
+	ASSERT(stats.collections[2] == 2, "incremental collection miscounted");
+	GC_terminate(1);
+	// everything starts over
+	GC_init();
+	GC_get_stats(&stats);
+	ASSERT(stats.collections[0] == 0 && stats.collections[2] == 0, "collections survived a restart");
+	ASSERT(stats.promoted == 0 && stats.finalised == 0, "counts survived a restart");
+	GC_terminate(1);
+	return 0;
+}
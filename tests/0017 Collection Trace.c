@@ -0,0 +1,74 @@
+#include "framework.h"
+#include <string.h>
+
+#define TRACE_FILE "collection-trace.json"
+
+static char contents[65536];
+
+static void READTRACE ()
+{
+	FILE* in = fopen(TRACE_FILE, "r");
+	size_t length;
+	ASSERT(in, "trace not written");
+	length = fread(contents, 1, sizeof(contents) - 1, in);
+	contents[length] = 0;
+	fclose(in);
+	remove(TRACE_FILE);
+}
+
+static int COUNT ( const char* needle )
+{
+	int count = 0;
+	const char* at;
+	for (at = strstr(contents, needle); at; at = strstr(at + 1, needle))
+		count++;
+	return count;
+}
+
+int main ()
+{
+	GC_config config;
+	object obj1, obj2;
+	const char* last;
+	int i;
+	GC_default_config(&config);
+	config.traceEvents = 256;
+	GC_init_with_config(&config);
+	obj1 = NEW();
+	obj2 = NEW();
+	GC_register_reference(obj1, obj2, NULL);
+	RELEASE(obj2);
+	GC_collect(1);
+	RELEASE(obj1);
+	GC_collect(0);
+	ASSERTDEAD(obj2);
+	ASSERT(GC_dump_trace(TRACE_FILE), "could not write trace");
+	READTRACE();
+	ASSERT(strncmp(contents, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39) == 0, "not a trace");
+	ASSERT(COUNT("\"name\":\"GC_collect\"") == 2, "collections not traced");
+	ASSERT(COUNT("\"name\":\"mark\"") == 2, "marking not traced");
+	// the partial collection sweeps the youngest generation, the full one all three
+	ASSERT(COUNT("\"name\":\"sweep\"") == 4, "sweeps not traced");
+	ASSERT(COUNT("\"name\":\"sweep\",\"cat\":\"gc\",\"ph\":\"X\"") == 4, "sweeps malformed");
+	ASSERT(COUNT("\"args\":{\"generation\":2}") == 1, "swept generation not recorded");
+	ASSERT(COUNT("\"name\":\"free\"") == 2, "freeing not traced");
+	// events are recorded as they end, so the outermost comes last
+	last = strstr(contents, "\"name\":\"GC_collect\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":1,\"tid\":1,");
+	ASSERT(last && (last = strstr(last + 1, "\"name\":\"GC_collect\"")), "collection events malformed");
+	ASSERT(!strstr(last + 1, "\"name\"") && strcmp(contents + strlen(contents) - 5, "}\n]}\n") == 0, "trace malformed");
+	// only the newest are kept
+	for (i = 0; i < 300; i++)
+		GC_collect(1);
+	ASSERT(GC_dump_trace(TRACE_FILE), "could not write trace");
+	READTRACE();
+	ASSERT(COUNT("\"ph\":\"X\"") == 256, "trace ring overran");
+	GC_terminate(1);
+	// off by default
+	GC_init();
+	GC_collect(0);
+	ASSERT(GC_dump_trace(TRACE_FILE), "could not write empty trace");
+	READTRACE();
+	ASSERT(COUNT("\"ph\":\"X\"") == 0, "traced while off");
+	GC_terminate(1);
+	return 0;
+}
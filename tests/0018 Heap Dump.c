@@ -0,0 +1,72 @@
+#include "framework.h"
+#include <string.h>
+
+#define DUMP_FILE "heap-dump.heap"
+
+static GC_heap_header header;
+static GC_heap_object objects[8];
+static GC_heap_edge edges[8];
+
+static void READDUMP ()
+{
+	FILE* in = fopen(DUMP_FILE, "rb");
+	ASSERT(in, "dump not written");
+	ASSERT(fread(&header, sizeof(header), 1, in) == 1, "dump too short");
+	ASSERT(memcmp(header.magic, GC_HEAP_MAGIC, 8) == 0, "not a heap dump");
+	ASSERT(header.objects <= 8 && header.edges <= 8, "dump too long");
+	ASSERT(fread(objects, sizeof(GC_heap_object), header.objects, in) == header.objects, "objects missing");
+	ASSERT(fread(edges, sizeof(GC_heap_edge), header.edges, in) == header.edges, "edges missing");
+	ASSERT(fgetc(in) == EOF, "dump has trailing bytes");
+	fclose(in);
+	remove(DUMP_FILE);
+}
+
+static int INDEX ( object obj )
+{
+	int i;
+	for (i = 0; i < (int)header.objects; i++)
+	{
+		if (objects[i].address == (unsigned long long)(size_t)obj)
+			return i;
+	}
+	ASSERT(0, "object missing from dump");
+	return -1;
+}
+
+int main ()
+{
+	object obj1, obj2, obj3;
+	void* weak;
+	int i, index1, index2, index3;
+	GC_init();
+	obj1 = NEW();
+	obj2 = GC_new_object(100, obj1, NULL);
+	obj3 = GC_new_object(20, GC_ROOT, NULL);
+	weak = obj1;
+	GC_register_weak_reference(obj3, obj1, &weak);
+	GC_register_reference(obj3, obj2, NULL);
+	GC_collect(1);
+	ASSERT(GC_dump_heap(DUMP_FILE), "could not write dump");
+	READDUMP();
+	ASSERT(header.objects == 4, "wrong number of objects");
+	ASSERT(header.edges == 5, "wrong number of edges");
+	// sorted by address, which puts the root first
+	ASSERT(objects[0].address == (unsigned long long)(size_t)GC_ROOT, "root not first");
+	for (i = 1; i < (int)header.objects; i++)
+		ASSERT(objects[i].address > objects[i - 1].address, "objects out of order");
+	index1 = INDEX(obj1);
+	index2 = INDEX(obj2);
+	index3 = INDEX(obj3);
+	ASSERT(objects[index1].size == 10 && objects[index2].size == 100, "sizes wrong");
+	ASSERT(objects[index1].flags == GC_HEAP_FINALISER && objects[index2].flags == 0, "finalisers wrong");
+	ASSERT(objects[index2].generation == 1 && objects[0].generation == 2, "generations wrong");
+	ASSERT(objects[0].edgeCount == 2 && objects[index1].edgeCount == 1 && objects[index3].edgeCount == 2, "edge counts wrong");
+	// each object's edges follow the previous object's
+	for (i = 1; i < (int)header.objects; i++)
+		ASSERT(objects[i].firstEdge == objects[i - 1].firstEdge + objects[i - 1].edgeCount, "edges not grouped by owner");
+	ASSERT(edges[objects[index1].firstEdge].target == (unsigned)index2, "strong edge wrong");
+	ASSERT((edges[objects[index3].firstEdge].target == (index1 | GC_HEAP_WEAK) && edges[objects[index3].firstEdge + 1].target == (unsigned)index2) ||
+	       (edges[objects[index3].firstEdge + 1].target == (index1 | GC_HEAP_WEAK) && edges[objects[index3].firstEdge].target == (unsigned)index2), "weak edge wrong");
+	GC_terminate(1);
+	return 0;
+}
@@ -0,0 +1,49 @@
+#include "framework.h"
+
+int main ()
+{
+	GC_retained largest[4];
+	object obj1, obj2, obj3, obj4, obj5, cycle1, cycle2;
+	void* weak;
+	GC_init();
+	// the root holds obj1 and obj3; obj4 hangs off both, so neither retains it
+	obj1 = NEW();
+	obj2 = GC_new_object(100, obj1, NULL);
+	obj3 = GC_new_object(20, GC_ROOT, NULL);
+	obj4 = GC_new_object(1000, obj2, NULL);
+	GC_register_reference(obj3, obj4, NULL);
+	// obj5 is only held strongly through obj1
+	obj5 = GC_new_object(50, obj1, NULL);
+	weak = obj5;
+	GC_register_weak_reference(obj3, obj5, &weak);
+	// a cycle the root has let go of, which no collection has found yet
+	cycle1 = NEW();
+	cycle2 = GC_new_object(30, cycle1, NULL);
+	GC_register_reference(cycle2, cycle1, NULL);
+	RELEASE(cycle1);
+	ASSERT(GC_retained_size(obj1) == 160, "retained size wrong");
+	ASSERT(GC_retained_size(obj2) == 100, "shared object counted as retained");
+	ASSERT(GC_retained_size(obj3) == 20, "weakly held object counted as retained");
+	ASSERT(GC_retained_size(obj4) == 1000, "leaf retained size wrong");
+	ASSERT(GC_retained_size(cycle1) == 0, "unreachable object retains bytes");
+	ASSERT(GC_retained_size(GC_ROOT) >= 1180 && GC_retained_size(GC_ROOT) < 1220, "root does not retain the heap");
+	ASSERT(GC_largest_retainers(largest, 4) == 4, "wrong number of retainers");
+	ASSERT(largest[0].object == obj4 && largest[0].heldBy == GC_ROOT, "largest retainer wrong");
+	ASSERT(largest[1].object == obj1 && largest[1].bytes == 160 && largest[1].objects == 3, "second retainer wrong");
+	ASSERT(largest[2].object == obj2 && largest[2].heldBy == obj1, "third retainer wrong");
+	ASSERT(largest[3].object == obj5 && largest[3].bytes == 50, "fourth retainer wrong");
+	ASSERT(GC_largest_retainers(largest, 0) == 0, "found retainers when asked for none");
+	// collections still work afterwards
+	GC_collect(1);
+	ASSERTDEAD(cycle1);
+	ASSERTDEAD(cycle2);
+	RELEASE(obj1);
+	GC_collect(0);
+	ASSERTDEAD(obj2);
+	ASSERTDEAD(obj5);
+	ASSERTWRZ(weak);
+	ASSERTLIVE(obj4);
+	ASSERT(GC_retained_size(obj3) == 1020, "retained size not updated");
+	GC_terminate(1);
+	return 0;
+}
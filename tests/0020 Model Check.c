@@ -0,0 +1,394 @@
+#include "framework.h"
+#include <string.h>
+
+// random operations checked against a model of what should be live: every object
+// strongly reachable from the root must survive, every weak reference to a dead
+// object must be cleared, every finaliser must run exactly once, and a full
+// collection must leave nothing unreachable behind. Each seed picks its own
+// configuration, taking in partial, incremental, automatic and triggered
+// collections, deferred finalisers and, in the thread-safe build, marking threads.
+//
+// usage: "0020 Model Check" [first seed] [seeds] [steps per seed]
+
+#define MAXOBJ 2000
+#define MAXEDGE 64
+#define MAXSLOTS (MAXOBJ * 8)
+
+typedef struct edge
+{
+	int target;
+	int weak;
+	int slot; // for a weak edge, where the reference is kept
+} edge;
+
+typedef struct model
+{
+	void* address;
+	int alive; // not yet finalised
+	int finalised;
+	int edgeCount;
+	edge edges[MAXEDGE];
+	int rootEdges;
+	int rootWeakSlot; // -1 if the root holds no weak reference to it
+	unsigned long length;
+	int foreign; // allocated outside the collector and registered
+} model;
+
+static model objects[MAXOBJ];
+static int reachable[MAXOBJ];
+static int objectCount;
+static void* slots[MAXSLOTS];
+static int slotCount;
+static int finalisersRun;
+
+// what this seed exercises
+static int partial, incremental, automatic, triggered, deferred;
+// while a cycle is under way, unreachable objects are garbage and must not be linked again
+static int cycleActive;
+
+static int RANDOM ( int n )
+{
+	return rand() % n;
+}
+
+static int FIND ( void* address )
+{
+	int i;
+	for (i = 0; i < objectCount; i++)
+	{
+		if (objects[i].alive && objects[i].address == address)
+			return i;
+	}
+	return -1;
+}
+
+static void FINALISE ( void* address )
+{
+	int i = FIND(address);
+	ASSERT(i >= 0, "finaliser called for an unknown object");
+	objects[i].alive = 0;
+	objects[i].finalised++;
+	if (objects[i].foreign)
+		free(address);
+	finalisersRun++;
+}
+
+static void REACH ()
+{
+	static int stack[MAXOBJ];
+	int top = 0, i, e;
+	memset(reachable, 0, sizeof(reachable));
+	for (i = 0; i < objectCount; i++)
+	{
+		if (objects[i].alive && objects[i].rootEdges > 0)
+		{
+			reachable[i] = 1;
+			stack[top++] = i;
+		}
+	}
+	while (top)
+	{
+		i = stack[--top];
+		for (e = 0; e < objects[i].edgeCount; e++)
+		{
+			edge* ed = &objects[i].edges[e];
+			if (!ed->weak && !reachable[ed->target])
+			{
+				reachable[ed->target] = 1;
+				stack[top++] = ed->target;
+			}
+		}
+	}
+}
+
+// edges of dead owners go with them, and weak edges to dead targets must have been cleared
+static void PRUNE ()
+{
+	int i, e, kept;
+	for (i = 0; i < objectCount; i++)
+	{
+		if (!objects[i].alive)
+		{
+			objects[i].edgeCount = 0;
+			continue;
+		}
+		kept = 0;
+		for (e = 0; e < objects[i].edgeCount; e++)
+		{
+			edge ed = objects[i].edges[e];
+			if (!objects[ed.target].alive)
+			{
+				// garbage an incremental sweep has yet to reach may outlive what it holds
+				ASSERT(ed.weak || !reachable[i], "target of a live strong edge died");
+				if (ed.weak)
+					ASSERTWRZ(slots[ed.slot]);
+				continue;
+			}
+			objects[i].edges[kept++] = ed;
+		}
+		objects[i].edgeCount = kept;
+	}
+	for (i = 0; i < objectCount; i++)
+	{
+		if (objects[i].rootWeakSlot >= 0 && !objects[i].alive)
+		{
+			ASSERTWRZ(slots[objects[i].rootWeakSlot]);
+			objects[i].rootWeakSlot = -1;
+		}
+	}
+}
+
+static void CHECK ( int full )
+{
+	int i;
+	if (deferred)
+		GC_run_finalisers(RANDOM(3) ? 0 : 1000000);
+	REACH();
+	PRUNE();
+	REACH();
+	for (i = 0; i < objectCount; i++)
+	{
+		ASSERT(objects[i].finalised <= 1, "finaliser called twice");
+		ASSERT(!reachable[i] || objects[i].alive, "reachable object died");
+		if (!objects[i].alive)
+			continue;
+		ASSERTLIVE(objects[i].address);
+		ASSERT(GC_object_size(objects[i].address) == objects[i].length, "object size wrong");
+		ASSERT(!full || reachable[i], "unreachable object survived a full collection");
+	}
+}
+
+static int USABLE ( int i )
+{
+	if (!cycleActive && !triggered)
+		return 1;
+	REACH();
+	return reachable[i];
+}
+
+static int PICK ()
+{
+	int tries;
+	for (tries = 0; tries < 50; tries++)
+	{
+		int i = RANDOM(objectCount);
+		if (objects[i].alive)
+			return i;
+	}
+	return -1;
+}
+
+static void ALLOCATE ()
+{
+	int owner = objectCount > 0 && RANDOM(3) == 0 ? PICK() : -1;
+	int foreign = RANDOM(10) == 0;
+	unsigned long length = foreign ? 0 : (RANDOM(20) == 0 ? 40000 + RANDOM(1000) : 1 + RANDOM(300));
+	unsigned long b;
+	void* ownerAddress;
+	void* address;
+	model* object;
+	if (owner >= 0 && !USABLE(owner))
+		owner = -1;
+	ownerAddress = owner < 0 ? GC_ROOT : objects[owner].address;
+	if (foreign)
+	{
+		address = malloc(32);
+		GC_register_object(address, ownerAddress, FINALISE);
+	}
+	else
+	{
+		address = GC_new_object(length, ownerAddress, FINALISE);
+		if (length < sizeof(void*))
+			length = sizeof(void*);
+		for (b = 0; b < length; b++)
+			ASSERT(((char*)address)[b] == 0, "new object not zeroed");
+		memset(address, 0xAB, length);
+	}
+	object = &objects[objectCount];
+	memset(object, 0, sizeof(*object));
+	object->address = address;
+	object->alive = 1;
+	object->rootWeakSlot = -1;
+	object->length = length;
+	object->foreign = foreign;
+	if (owner < 0)
+	{
+		object->rootEdges = 1;
+	}
+	else
+	{
+		edge e = { objectCount, 0, -1 };
+		objects[owner].edges[objects[owner].edgeCount++] = e;
+	}
+	objectCount++;
+}
+
+static void LINK ()
+{
+	int a = PICK(), b = PICK(), e;
+	if (a < 0 || b < 0 || objects[a].edgeCount >= MAXEDGE - 1 || !USABLE(b))
+		return;
+	if (RANDOM(4) == 0)
+	{
+		// at most one weak edge per pair, so it is known which reference gets cleared
+		edge weak = { b, 1, slotCount };
+		for (e = 0; e < objects[a].edgeCount; e++)
+		{
+			if (objects[a].edges[e].weak && objects[a].edges[e].target == b)
+				return;
+		}
+		if (slotCount >= MAXSLOTS)
+			return;
+		slots[slotCount++] = objects[b].address;
+		GC_register_weak_reference(objects[a].address, objects[b].address, &slots[weak.slot]);
+		objects[a].edges[objects[a].edgeCount++] = weak;
+	}
+	else
+	{
+		edge strong = { b, 0, -1 };
+		GC_register_reference(objects[a].address, objects[b].address, NULL);
+		objects[a].edges[objects[a].edgeCount++] = strong;
+	}
+}
+
+static void UNLINK ()
+{
+	int a = PICK(), e;
+	edge ed;
+	if (a < 0 || objects[a].edgeCount == 0)
+		return;
+	e = RANDOM(objects[a].edgeCount);
+	ed = objects[a].edges[e];
+	if (ed.weak)
+		GC_unregister_weak_reference(objects[a].address, objects[ed.target].address);
+	else
+		GC_unregister_reference(objects[a].address, objects[ed.target].address);
+	objects[a].edges[e] = objects[a].edges[--objects[a].edgeCount];
+}
+
+// moves an object the root holds weakly, which says where to find it afterwards
+static void RESIZE ()
+{
+	int a = PICK();
+	unsigned long length, keep, b;
+	if (a < 0 || objects[a].rootWeakSlot < 0 || objects[a].foreign)
+		return;
+	length = 1 + RANDOM(RANDOM(5) == 0 ? 50000 : 400);
+	keep = length < objects[a].length ? length : objects[a].length;
+	GC_object_resize(objects[a].address, length);
+	objects[a].address = slots[objects[a].rootWeakSlot];
+	for (b = 0; b < keep; b++)
+		ASSERT(((unsigned char*)objects[a].address)[b] == 0xAB, "resize lost the contents");
+	memset(objects[a].address, 0xAB, length);
+	objects[a].length = length;
+}
+
+static void RUN ( int seed, int steps )
+{
+	GC_config config;
+	int step, i, alive = 0, before;
+	srand(seed);
+	objectCount = slotCount = finalisersRun = 0;
+	cycleActive = 0;
+	partial = seed % 2;
+	incremental = seed % 3 == 1;
+	automatic = seed % 5 == 2;
+	triggered = seed % 7 == 3;
+	deferred = seed % 4 == 1;
+	GC_default_config(&config);
+	config.generations = 2 + seed % 3;
+	config.tenureAge = 1 + seed % 3;
+	config.deferFinalisers = deferred;
+#ifdef GC_THREAD_SAFE
+	config.markThreads = 1 + seed % 2;
+#endif
+	if (triggered)
+	{
+		config.triggers.nurseryObjects = 100;
+		config.triggers.nurseryBytes = 20000;
+		config.triggers.heapGrowth = 50;
+	}
+	GC_init_with_config(&config);
+	for (step = 0; step < steps; step++)
+	{
+		int op = RANDOM(100);
+		if ((op < 25 || objectCount < 5) && objectCount < MAXOBJ)
+		{
+			ALLOCATE();
+		}
+		else if (op < 50)
+		{
+			LINK();
+		}
+		else if (op < 70)
+		{
+			UNLINK();
+		}
+		else if (op < 85)
+		{
+			int a = PICK();
+			if (a < 0 || objects[a].rootEdges == 0)
+				continue;
+			GC_unregister_reference(GC_ROOT, objects[a].address);
+			objects[a].rootEdges--;
+		}
+		else if (op < 88)
+		{
+			int a = PICK();
+			if (a < 0 || objects[a].rootWeakSlot >= 0 || slotCount >= MAXSLOTS || !USABLE(a))
+				continue;
+			slots[slotCount] = objects[a].address;
+			GC_register_weak_reference(GC_ROOT, objects[a].address, &slots[slotCount]);
+			objects[a].rootWeakSlot = slotCount++;
+		}
+		else if (op < 90)
+		{
+			RESIZE();
+		}
+		else if (op < 95 && incremental && RANDOM(2))
+		{
+			cycleActive = !GC_collect_step(RANDOM(4) == 0 ? 100 : 0);
+			CHECK(0);
+			continue;
+		}
+		else if (op < 95)
+		{
+			cycleActive = 0;
+			if (automatic)
+			{
+				GC_collect_auto(NULL);
+				CHECK(0);
+				continue;
+			}
+			GC_collect(partial);
+			CHECK(!partial);
+			continue;
+		}
+		else
+		{
+			cycleActive = 0;
+			GC_collect(0);
+			CHECK(1);
+			continue;
+		}
+		CHECK(0);
+	}
+	GC_collect(0);
+	CHECK(1);
+	before = finalisersRun;
+	for (i = 0; i < objectCount; i++)
+		alive += objects[i].alive;
+	GC_terminate(1);
+	ASSERT(finalisersRun - before == alive, "terminate missed finalisers");
+}
+
+int main ( int argc, char** argv )
+{
+	int first = argc > 1 ? atoi(argv[1]) : 1;
+	int seeds = argc > 2 ? atoi(argv[2]) : 24;
+	int steps = argc > 3 ? atoi(argv[3]) : 3000;
+	int seed;
+	for (seed = first; seed < first + seeds; seed++)
+		RUN(seed, steps);
+	return 0;
+}
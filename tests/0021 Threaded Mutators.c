@@ -0,0 +1,259 @@
+#include "framework.h"
+#include <string.h>
+
+// several mutator threads allocating, linking and dropping objects while the
+// collector runs: from the background thread, from the mutators themselves and
+// from allocation triggers, with finalisers on their own thread or deferred, and
+// with objects handed from one thread to another before anyone has reached a
+// safepoint. Every object must be finalised exactly once, and only once nothing
+// holds it. Only meaningful in the thread-safe build.
+//
+// usage: "0021 Threaded Mutators" [threads] [iterations per thread]
+
+#ifdef GC_THREAD_SAFE
+
+#include <pthread.h>
+
+#define SHARED 64
+#define LOCAL 256
+#define MAILBOX 128
+#define PAYLOAD 0x5A
+
+static void* shared[SHARED];
+static void* box; // what holds objects on their way between threads
+static void* mailbox[MAILBOX];
+static int mailboxCount;
+static pthread_mutex_t mailboxLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile long created, finalised;
+static int iterations;
+
+// what this run exercises
+static int rootOwned, batched, handles, deferred, collections;
+
+static void FINALISE ( void* address )
+{
+	ASSERT(((unsigned char*)address)[8] == PAYLOAD, "finalised object has lost its contents");
+	__sync_add_and_fetch(&finalised, 1);
+}
+
+static void* CREATE ( unsigned long length, void* owner )
+{
+	void* address;
+	if (batched)
+		GC_new_objects(&address, 1, length, owner, FINALISE);
+	else
+		address = GC_new_object(length, owner, FINALISE);
+	memset(address, PAYLOAD, length);
+	__sync_add_and_fetch(&created, 1);
+	return address;
+}
+
+// an object made here and let go of by whichever thread collects it
+static void POST ( unsigned* seed )
+{
+	void* address = CREATE(24, box);
+	int i;
+	pthread_mutex_lock(&mailboxLock);
+	if (mailboxCount < MAILBOX)
+	{
+		mailbox[mailboxCount++] = address;
+	}
+	else
+	{
+		i = rand_r(seed) % MAILBOX;
+		GC_unregister_reference(box, mailbox[i]);
+		mailbox[i] = address;
+	}
+	pthread_mutex_unlock(&mailboxLock);
+}
+
+static void TAKE ()
+{
+	pthread_mutex_lock(&mailboxLock);
+	if (mailboxCount > 0)
+	{
+		int i = --mailboxCount;
+		ASSERTLIVE(mailbox[i]);
+		GC_unregister_reference(box, mailbox[i]);
+	}
+	pthread_mutex_unlock(&mailboxLock);
+}
+
+static void* MUTATOR ( void* argument )
+{
+	unsigned seed = (unsigned)(size_t)argument * 7919 + 1;
+	void* owner = rootOwned ? GC_ROOT : GC_new_object(32, GC_ROOT, NULL);
+	void* local[LOCAL];
+	void* weak[LOCAL];
+	int held[LOCAL]; // which shared object each local one holds, or -1
+	int i, j, k, op;
+	memset(local, 0, sizeof(local));
+	for (i = 0; i < iterations; i++)
+	{
+		op = rand_r(&seed) % 100;
+		k = rand_r(&seed) % LOCAL;
+		if (op < 35)
+		{
+			if (local[k])
+			{
+				if (weak[k])
+					GC_unregister_weak_reference(owner, local[k]);
+				if (held[k] >= 0)
+					GC_unregister_reference(local[k], shared[held[k]]);
+				GC_unregister_reference(owner, local[k]);
+			}
+			local[k] = CREATE(16 + rand_r(&seed) % 200, owner);
+			weak[k] = NULL;
+			held[k] = -1;
+			if (rand_r(&seed) % 2)
+			{
+				held[k] = rand_r(&seed) % SHARED;
+				GC_register_reference(local[k], shared[held[k]], NULL);
+			}
+			if (rand_r(&seed) % 4 == 0)
+			{
+				weak[k] = local[k];
+				GC_register_weak_reference(owner, local[k], &weak[k]);
+			}
+		}
+		else if (op < 45)
+		{
+			if (op % 2)
+				POST(&seed);
+			else
+				TAKE();
+		}
+		else if (op < 70)
+		{
+			j = rand_r(&seed) % LOCAL;
+			if (local[k] && local[j])
+			{
+				GC_edge edges[2] = { { local[k], local[j], NULL }, { local[k], local[j], NULL } };
+				if (batched)
+				{
+					GC_register_references(edges, 2);
+					GC_unregister_references(edges, 2);
+				}
+				else
+				{
+					GC_register_reference(local[k], local[j], NULL);
+					GC_unregister_reference(local[k], local[j]);
+				}
+			}
+		}
+		else if (op < 98 || !collections)
+		{
+			if (!local[k])
+				continue;
+			ASSERTLIVE(local[k]);
+			ASSERT(GC_object_size(local[k]) >= 16, "object size wrong");
+			ASSERT(((unsigned char*)local[k])[8] == PAYLOAD, "live object has lost its contents");
+			if (weak[k])
+				ASSERT(weak[k] == local[k], "weak reference to a live object changed");
+			if (handles)
+			{
+				GC_handle handle = GC_object_handle(local[k]);
+				GC_handle sharedHandle = GC_object_handle(shared[k % SHARED]);
+				ASSERT(GC_object_live_h(handle) && GC_object_address_h(handle) == local[k], "handle lost its object");
+				ASSERT(GC_object_address_h(sharedHandle) == shared[k % SHARED], "handle lost a shared object");
+				GC_register_reference_h(handle, sharedHandle, NULL);
+				GC_unregister_reference_h(handle, sharedHandle);
+			}
+		}
+		else
+		{
+			if (deferred)
+				GC_run_finalisers(rand_r(&seed) % 100);
+			GC_collect(rand_r(&seed) % 2);
+		}
+	}
+	// the root outlives this stack, which its weak references point into
+	for (k = 0; k < LOCAL; k++)
+	{
+		if (rootOwned && local[k] && weak[k])
+			GC_unregister_weak_reference(owner, local[k]);
+	}
+	if (!rootOwned)
+		GC_unregister_reference(GC_ROOT, owner);
+	return NULL;
+}
+
+static void RUN ( int threads, GC_config* config )
+{
+	pthread_t mutators[64];
+	GC_stats stats;
+	int i;
+	created = finalised = 0;
+	mailboxCount = 0;
+	GC_init_with_config(config);
+	for (i = 0; i < SHARED; i++)
+	{
+		shared[i] = GC_new_object(16, GC_ROOT, FINALISE);
+		memset(shared[i], PAYLOAD, 16);
+	}
+	box = GC_new_object(8, GC_ROOT, NULL);
+	created = SHARED;
+	for (i = 0; i < threads; i++)
+		pthread_create(&mutators[i], NULL, MUTATOR, (void*)(size_t)i);
+	for (i = 0; i < threads; i++)
+		pthread_join(mutators[i], NULL);
+	GC_get_stats(&stats);
+	ASSERT(!config->backgroundInterval || stats.collections[stats.generations - 1] > 0, "background collector never ran");
+	GC_collect(0);
+	for (i = 0; i < SHARED; i++)
+		ASSERTLIVE(shared[i]);
+	for (i = 0; i < mailboxCount; i++)
+		ASSERTLIVE(mailbox[i]);
+	GC_terminate(1);
+	ASSERT(finalised == created, "objects not finalised exactly once");
+}
+
+int main ( int argc, char** argv )
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	GC_config config;
+	iterations = argc > 2 ? atoi(argv[2]) : 5000;
+	if (threads > 64)
+		threads = 64;
+	// the background collector does all the collecting, and finalisers have their own thread
+	GC_default_config(&config);
+	config.backgroundInterval = 1;
+	config.deferFinalisers = 1;
+	config.finaliserThread = 1;
+	config.markThreads = 2;
+	rootOwned = batched = handles = deferred = collections = 0;
+	RUN(threads, &config);
+	// the root owns what the mutators make, and allocation triggers collections
+	GC_default_config(&config);
+	config.triggers.nurseryObjects = 200;
+	config.triggers.heapGrowth = 50;
+	rootOwned = batched = collections = 1;
+	RUN(threads, &config);
+	// the mutators collect, through handles, with finalisers run when they ask
+	GC_default_config(&config);
+	config.deferFinalisers = 1;
+	config.markThreads = 3;
+	rootOwned = batched = 0;
+	handles = deferred = collections = 1;
+	RUN(threads, &config);
+	// all of it at once
+	GC_default_config(&config);
+	config.backgroundInterval = 2;
+	config.deferFinalisers = 1;
+	config.finaliserThread = 1;
+	config.markThreads = 2;
+	config.triggers.nurseryObjects = 500;
+	rootOwned = handles = collections = 1;
+	batched = deferred = 0;
+	RUN(threads, &config);
+	return 0;
+}
+
+#else
+
+int main ()
+{
+	return 0;
+}
+
+#endif
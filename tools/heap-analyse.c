@@ -0,0 +1,361 @@
+#include "gc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// reads a dump from GC_dump_heap in place and reports what is keeping memory alive:
+// the objects whose death would free the most, the objects holding the most
+// references, and the chain of strong references from the root to any object
+//
+// the bytes an object retains are those of everything only reachable through it,
+// found from the dominator tree of the strong references (Cooper, Harvey and
+// Kennedy's iterative algorithm over a depth-first postorder)
+//
+// usage: heap-analyse dump [-n count] [-p address]
+
+#define UNREACHED 0xFFFFFFFFu
+#define GENERATIONS 16 // reported apart; any older are counted with the last
+
+static const GC_heap_object* objects;
+static const GC_heap_edge* edges;
+static unsigned long long objectCount;
+static unsigned long long edgeCount;
+
+static unsigned* order; // postorder number of each object, or UNREACHED
+static unsigned* byOrder; // object at each postorder number
+static unsigned reached;
+static unsigned* dominator; // immediate dominator, by postorder number
+static unsigned long long* retained;
+
+static const void* MAP ( const char* path, size_t* length )
+{
+	struct stat info;
+	void* data;
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return NULL;
+	if (fstat(file, &info) < 0 || info.st_size < (off_t)sizeof(GC_heap_header))
+	{
+		close(file);
+		return NULL;
+	}
+	*length = info.st_size;
+	data = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	return data == MAP_FAILED ? NULL : data;
+}
+
+static int STRONG ( const GC_heap_edge* edge )
+{
+	return !(edge->target & GC_HEAP_WEAK);
+}
+
+// numbers everything strongly reachable from the root in postorder
+static void NUMBER ()
+{
+	unsigned* stack = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	unsigned* next = (unsigned*)calloc(objectCount, sizeof(unsigned));
+	unsigned long long i;
+	size_t depth = 0;
+	for (i = 0; i < objectCount; i++)
+		order[i] = UNREACHED;
+	// mark on the way in, number on the way out
+	order[0] = 0;
+	stack[depth++] = 0;
+	while (depth)
+	{
+		unsigned object = stack[depth - 1];
+		if (next[object] < objects[object].edgeCount)
+		{
+			const GC_heap_edge* edge = &edges[objects[object].firstEdge + next[object]++];
+			unsigned target = edge->target & ~GC_HEAP_WEAK;
+			if (STRONG(edge) && order[target] == UNREACHED)
+			{
+				order[target] = 0;
+				stack[depth++] = target;
+			}
+			continue;
+		}
+		depth--;
+		order[object] = reached;
+		byOrder[reached++] = object;
+	}
+	free(stack);
+	free(next);
+}
+
+static unsigned INTERSECT ( unsigned a, unsigned b )
+{
+	while (a != b)
+	{
+		while (a < b)
+			a = dominator[a];
+		while (b < a)
+			b = dominator[b];
+	}
+	return a;
+}
+
+static void DOMINATE ()
+{
+	// the strong references into each reached object, by postorder number
+	unsigned long long* first = (unsigned long long*)calloc(reached + 1, sizeof(unsigned long long));
+	unsigned* from;
+	unsigned long long i, e;
+	unsigned n;
+	int changed = 1;
+	for (i = 0; i < objectCount; i++)
+	{
+		if (order[i] == UNREACHED)
+			continue;
+		for (e = objects[i].firstEdge; e < objects[i].firstEdge + objects[i].edgeCount; e++)
+		{
+			if (STRONG(&edges[e]))
+				first[order[edges[e].target] + 1]++;
+		}
+	}
+	for (n = 0; n < reached; n++)
+		first[n + 1] += first[n];
+	from = (unsigned*)malloc((first[reached] + 1) * sizeof(unsigned));
+	{
+		unsigned long long* fill = (unsigned long long*)malloc(reached * sizeof(unsigned long long));
+		memcpy(fill, first, reached * sizeof(unsigned long long));
+		for (i = 0; i < objectCount; i++)
+		{
+			if (order[i] == UNREACHED)
+				continue;
+			for (e = objects[i].firstEdge; e < objects[i].firstEdge + objects[i].edgeCount; e++)
+			{
+				if (STRONG(&edges[e]))
+					from[fill[order[edges[e].target]]++] = order[i];
+			}
+		}
+		free(fill);
+	}
+	// the root is numbered last; everything else starts out undetermined
+	for (n = 0; n < reached; n++)
+		dominator[n] = UNREACHED;
+	dominator[reached - 1] = reached - 1;
+	while (changed)
+	{
+		changed = 0;
+		for (n = reached - 1; n-- > 0;)
+		{
+			unsigned best = UNREACHED;
+			for (i = first[n]; i < first[n + 1]; i++)
+			{
+				if (dominator[from[i]] == UNREACHED)
+					continue;
+				best = best == UNREACHED ? from[i] : INTERSECT(from[i], best);
+			}
+			if (best != dominator[n])
+			{
+				dominator[n] = best;
+				changed = 1;
+			}
+		}
+	}
+	free(first);
+	free(from);
+	// a dominator always comes later in postorder, so one pass adds everything up
+	for (n = 0; n < reached; n++)
+		retained[n] = objects[byOrder[n]].size;
+	for (n = 0; n + 1 < reached; n++)
+		retained[dominator[n]] += retained[n];
+}
+
+// the count largest by score, as indices into whatever score was given for
+static unsigned TOP ( unsigned* best, unsigned count, const unsigned long long* score, unsigned total )
+{
+	unsigned found = 0, n, k;
+	for (n = 0; n < total; n++)
+	{
+		if (found == count && score[n] <= score[best[found - 1]])
+			continue;
+		k = found < count ? found++ : found - 1;
+		while (k > 0 && score[best[k - 1]] < score[n])
+		{
+			best[k] = best[k - 1];
+			k--;
+		}
+		best[k] = n;
+	}
+	return found;
+}
+
+static void SUMMARY ()
+{
+	unsigned long long bytes = 0, strong = 0, unreachedBytes = 0, i, e;
+	unsigned long long generationObjects[GENERATIONS] = { 0 }, generationBytes[GENERATIONS] = { 0 };
+	unsigned generations = 0, g;
+	for (i = 0; i < objectCount; i++)
+	{
+		g = objects[i].generation < GENERATIONS ? objects[i].generation : GENERATIONS - 1;
+		if (g >= generations)
+			generations = g + 1;
+		generationObjects[g]++;
+		generationBytes[g] += objects[i].size;
+		bytes += objects[i].size;
+		if (order[i] == UNREACHED)
+			unreachedBytes += objects[i].size;
+		for (e = objects[i].firstEdge; e < objects[i].firstEdge + objects[i].edgeCount; e++)
+			strong += STRONG(&edges[e]);
+	}
+	printf("objects\t%llu\nbytes\t%llu\n", objectCount, bytes);
+	for (g = 0; g < generations; g++)
+		printf("generation_%u\t%llu\t%llu\n", g, generationObjects[g], generationBytes[g]);
+	printf("strong_references\t%llu\nweak_references\t%llu\n", strong, edgeCount - strong);
+	// only weakly held, or unreferenced and not yet collected
+	printf("unreachable_objects\t%llu\nunreachable_bytes\t%llu\n", objectCount - reached, unreachedBytes);
+}
+
+static void RETAINED ( unsigned count )
+{
+	unsigned* best = (unsigned*)malloc(count * sizeof(unsigned));
+	unsigned found = TOP(best, count, retained, reached - 1), k;
+	printf("\n# retained\taddress\tsize\tretained\tgeneration\theld_by\n");
+	for (k = 0; k < found; k++)
+	{
+		const GC_heap_object* object = &objects[byOrder[best[k]]];
+		printf("retained\t0x%llx\t%llu\t%llu\t%u\t0x%llx\n", object->address, object->size, retained[best[k]],
+		       object->generation, objects[byOrder[dominator[best[k]]]].address);
+	}
+	free(best);
+}
+
+static void FANOUT ( unsigned count )
+{
+	unsigned long long* strong = (unsigned long long*)calloc(objectCount, sizeof(unsigned long long));
+	unsigned* best = (unsigned*)malloc(count * sizeof(unsigned));
+	unsigned long long i, e;
+	unsigned found, k;
+	for (i = 0; i < objectCount; i++)
+	{
+		for (e = objects[i].firstEdge; e < objects[i].firstEdge + objects[i].edgeCount; e++)
+			strong[i] += STRONG(&edges[e]);
+	}
+	found = TOP(best, count, strong, (unsigned)objectCount);
+	printf("\n# fanout\taddress\tsize\tstrong\tweak\n");
+	for (k = 0; k < found; k++)
+	{
+		const GC_heap_object* object = &objects[best[k]];
+		printf("fanout\t0x%llx\t%llu\t%llu\t%llu\n", object->address, object->size, strong[best[k]], object->edgeCount - strong[best[k]]);
+	}
+	free(strong);
+	free(best);
+}
+
+static long long FIND ( unsigned long long address )
+{
+	unsigned long long low = 0, high = objectCount;
+	while (low < high)
+	{
+		unsigned long long middle = (low + high) / 2;
+		if (objects[middle].address < address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < objectCount && objects[low].address == address ? (long long)low : -1;
+}
+
+// the shortest chain of strong references from the root, found breadth first
+static void PATH ( unsigned long long address )
+{
+	long long wanted = FIND(address);
+	unsigned* queue;
+	unsigned* parent;
+	unsigned head = 0, tail = 0, object, length = 0;
+	unsigned long long e;
+	printf("\n# path\taddress\tsize\tgeneration\n");
+	if (wanted < 0)
+	{
+		printf("path\tno object at 0x%llx\n", address);
+		return;
+	}
+	if (order[wanted] == UNREACHED)
+	{
+		printf("path\t0x%llx is not strongly reachable\n", address);
+		return;
+	}
+	queue = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	parent = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	memset(parent, 0xFF, objectCount * sizeof(unsigned));
+	parent[0] = 0;
+	queue[tail++] = 0;
+	while (head < tail && parent[wanted] == UNREACHED)
+	{
+		object = queue[head++];
+		for (e = objects[object].firstEdge; e < objects[object].firstEdge + objects[object].edgeCount; e++)
+		{
+			unsigned target = edges[e].target;
+			if (STRONG(&edges[e]) && parent[target] == UNREACHED)
+			{
+				parent[target] = object;
+				queue[tail++] = target;
+			}
+		}
+	}
+	// walked back from the object, then printed from the root
+	for (object = (unsigned)wanted; object != 0; object = parent[object])
+		queue[length++] = object;
+	queue[length++] = 0;
+	while (length--)
+	{
+		const GC_heap_object* step = &objects[queue[length]];
+		printf("path\t0x%llx\t%llu\t%u\n", step->address, step->size, step->generation);
+	}
+	free(queue);
+	free(parent);
+}
+
+int main ( int argc, char** argv )
+{
+	const GC_heap_header* header;
+	size_t length;
+	unsigned count = 10;
+	unsigned long long pathTo = 0;
+	int i;
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s dump [-n count] [-p address]\n", argv[0]);
+		return 1;
+	}
+	for (i = 2; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+			count = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-p"))
+			pathTo = strtoull(argv[i + 1], NULL, 0);
+	}
+	header = (const GC_heap_header*)MAP(argv[1], &length);
+	if (!header || memcmp(header->magic, GC_HEAP_MAGIC, sizeof(header->magic)) ||
+	    length < sizeof(*header) + header->objects * sizeof(GC_heap_object) + header->edges * sizeof(GC_heap_edge) || !header->objects)
+	{
+		fprintf(stderr, "%s: not a heap dump\n", argv[1]);
+		return 1;
+	}
+	objectCount = header->objects;
+	edgeCount = header->edges;
+	objects = (const GC_heap_object*)(header + 1);
+	edges = (const GC_heap_edge*)(objects + objectCount);
+	order = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	byOrder = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	dominator = (unsigned*)malloc(objectCount * sizeof(unsigned));
+	retained = (unsigned long long*)malloc(objectCount * sizeof(unsigned long long));
+	NUMBER();
+	DOMINATE();
+	SUMMARY();
+	if (count)
+	{
+		RETAINED(count);
+		FANOUT(count);
+	}
+	if (pathTo)
+		PATH(pathTo);
+	return 0;
+}